@@ -37,16 +37,22 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <sys/procfs.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/ucontext.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #include <utlist.h>
+#include <uthash.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
@@ -68,11 +74,21 @@
 #include <aux.h>
 #include <inttypes.h>
 #include <capstone/capstone.h>
+#include <libiberty/sha1.h>
+#include <linux/fs.h>
+#include <dirent.h>
 
 #include <config.h>
 
 #define DEFAULT_STRNDX_SIZE 4096
 
+#define SHA1_DIGEST_SIZE 20
+
+#define STATS_MAX_PHASES 32
+
+#define OUT_PAGE_SHIFT 12
+#define OUT_PAGE_SIZE (1UL << OUT_PAGE_SHIFT)
+
 // Valid flags for msec_t->flags
 #define FLAG_BSS        1
 #define FLAG_NOBIT      2
@@ -81,6 +97,13 @@
 
 #define EXTRA_CREATED_SECTIONS 5
 
+#define GBUF_MIN_SIZE 4096
+
+#define TEXT_CHUNK_MIN_SIZE 4096	// smallest .text chunk disassembled by a worker thread
+#define TEXT_CHUNKS_PER_JOB 16		// chunks per worker thread, for load balancing
+#define TEXT_CHUNKS_AHEAD 4		// chunks per worker thread decoded ahead of merging
+#define MAX_JOBS 256			// upper bound of -j/--jobs
+
 
 #define RELOC_X86_64 1
 #define RELOC_X86_32 2
@@ -260,6 +283,51 @@ typedef struct mseg_t {
 
 } mseg_t;
 
+/**
+* Section address range
+*/
+typedef struct secrange_t {
+	unsigned long int start;	// first address in range
+	unsigned long int end;		// last address in range + 1
+	msec_t *sec;
+} secrange_t;
+
+/**
+* Section name lookup entry
+*/
+typedef struct secname_t {
+	char *name;			// key
+	msec_t *sec;			// first section with this name
+	unsigned int index;		// index of this section (counting from 1)
+	unsigned int index_after_strip;	// index of this section after stripping
+	UT_hash_handle hh;		// uthash.h
+} secname_t;
+
+/**
+* Section lookup index, built from ctx->mshdrs
+*/
+typedef struct secidx_t {
+	msec_t **byindex;		// sections in list order
+	unsigned int nsec;
+	msec_t **allowed;		// sections kept after stripping, in list order
+	unsigned int nallowed;
+	secrange_t *ranges;		// sorted, non overlapping address ranges
+	unsigned int nranges;
+	secname_t *names;
+} secidx_t;
+
+/**
+* In memory image of the output binary, written to disk once by out_flush()
+*/
+typedef struct outimg_t {
+	char *data;		// output file content
+	unsigned long len;	// current output file size
+	unsigned long cap;	// allocated size of data (multiple of OUT_PAGE_SIZE)
+	unsigned long pos;	// current write offset
+	unsigned char *dirty;	// per page : 1 if data holds the page, 0 if it is still the input's
+	unsigned long origsz;	// size of the input binary
+	int fdin;		// input binary, source of pages never written to
+} outimg_t;
 
 typedef struct ctx_t {
 
@@ -276,6 +344,7 @@ typedef struct ctx_t {
 	unsigned int start_shdrs;	// Offset of section headers in output binary
 	unsigned int start_phdrs;	// Offset of Program headers in output binary
 	int fdout;
+	outimg_t *out;		// output image, flushed to fdout at the end of libify()
 	bfd *abfd;
 	unsigned int corefile;	// 1 if file is a core file
 
@@ -291,6 +360,9 @@ typedef struct ctx_t {
 
 	unsigned int has_relativerelocations;	// 1 if binary has relative relocations (R_X86_64_RELATIVE)
 
+	// Section lookup index (rebuilt when mshdrs changes)
+	secidx_t *secidx;
+
 	/**
 	* User options
 	*/
@@ -314,6 +386,13 @@ typedef struct ctx_t {
 	unsigned int opt_debug;
 	unsigned int opt_asmdebug;
 	unsigned int opt_flags;	// used in setting eabi
+	unsigned int opt_jobs;	// number of disassembly threads
+	unsigned int opt_stream;	// disassemble one instruction at a time
+	unsigned int opt_stats;	// print per phase statistics (1: table, 2: json)
+	unsigned long int opt_max_rss;	// maximum expected resident set size, in KB
+	char *opt_batch;	// file listing binaries to process ("-" for stdin)
+	char *opt_cache;	// output cache directory
+	unsigned long int opt_cache_size;	// maximum size of the output cache, in bytes (0: unlimited)
 
 } ctx_t;
 
@@ -323,6 +402,23 @@ struct symaddr {
 	int addr;
 } *symaddrs;
 
+/**
+* Batch mode target
+*/
+typedef struct batch_t {
+	char *input;
+	char *output;
+	pid_t pid;		// worker process
+	int status;		// as returned by waitpid()
+	struct timespec start;
+	double elapsed;		// wall time in seconds
+
+	struct batch_t *prev;	// utlist.h
+	struct batch_t *next;	// utlist.h
+	UT_hash_handle hh;	// uthash.h, keyed by output
+
+} batch_t;
+
 typedef struct gimport_t {
 	char *sname;
 	msec_t *sec;
@@ -334,6 +430,38 @@ typedef struct gimport_t {
 gimport_t **gimports = 0;
 unsigned int gimportslen = 0;
 
+/**
+* Global imports index : relocation offset to index in gimports
+*/
+typedef struct gimportidx_t {
+	unsigned long int offset;	// key
+	unsigned int index;		// first entry in gimports with this relocation offset
+	UT_hash_handle hh;		// uthash.h
+} gimportidx_t;
+
+gimportidx_t *gimportsidx = 0;
+
+/**
+* Symbol table index : number of symbols in globalsymtab per value
+*/
+typedef struct symvalue_t {
+	unsigned long long int value;	// key
+	unsigned int count;
+	UT_hash_handle hh;	// uthash.h
+} symvalue_t;
+
+/**
+* String table index : strings present in globalstrtab
+*/
+typedef struct symname_t {
+	char *name;		// key
+	UT_hash_handle hh;	// uthash.h
+} symname_t;
+
+symvalue_t *symvalues = 0;
+symname_t *symnames = 0;
+unsigned int symnamesoffset = 0;	// offset in globalstrtab up to which strings are indexed
+
 /**
 * Forward prototypes declarations
 */
@@ -346,6 +474,8 @@ unsigned int secindex_from_name(ctx_t * ctx, const char *name);
 msec_t *section_from_index(ctx_t * ctx, unsigned int index);
 unsigned int secindex_from_name_after_strip(ctx_t * ctx, const char *name);
 int analyze_text(ctx_t * ctx, char *data, unsigned int datalen, unsigned long int addr);
+int analyze_text_parallel(ctx_t * ctx, char *data, unsigned int datalen, unsigned long int addr);
+int analyze_text_stream(ctx_t * ctx, char *data, unsigned int datalen, unsigned long int addr);
 int save_reloc(ctx_t * ctx, Elf_Rela * r, unsigned int sindex, int has_addend);
 int analyze_data(ctx_t * ctx, msec_t * s);
 
@@ -383,6 +513,55 @@ unsigned long int datavma = 0;
 unsigned long int orig_text = 0;
 unsigned long int orig_sz = 0;
 
+char *funcstarts = 0;		// addresses of known functions (unsigned long int)
+unsigned int funcstartslen = 0;
+
+/**
+* Growable buffer holding one of the global tables above
+*/
+typedef struct gbuf_t {
+	char **data;		// address of the global pointer to the table
+	unsigned long int cap;	// allocated size in bytes
+} gbuf_t;
+
+gbuf_t gbuf_symtab = { &globalsymtab, 0 };
+gbuf_t gbuf_strtab = { &globalstrtab, 0 };
+gbuf_t gbuf_reloc = { &globalreloc, 0 };
+gbuf_t gbuf_datareloc = { &globaldatareloc, 0 };
+gbuf_t gbuf_gimports = { (char **) &gimports, 0 };
+gbuf_t gbuf_rela_data_rel_ro_local = { &rela_data_rel_ro_local, 0 };
+gbuf_t gbuf_funcstarts = { &funcstarts, 0 };
+
+unsigned long int gbuf_total = 0;	// bytes allocated over the whole run
+unsigned long int gbuf_inuse = 0;	// bytes currently allocated
+unsigned long int gbuf_peak = 0;	// maximum of gbuf_inuse
+
+/**
+* Statistics for --stats
+*/
+typedef struct phase_t {
+	const char *name;
+	double wall;		// seconds
+	double cpu;		// seconds (user + system)
+	long rss;		// resident set size delta, in KB
+} phase_t;
+
+typedef struct wstats_t {
+	phase_t phases[STATS_MAX_PHASES];
+	unsigned int nphases;
+	phase_t *cur;		// phase being measured
+	struct timespec wall0;
+	struct timespec cpu0;
+	long rss0;
+	unsigned long int insns;	// instructions decoded
+	unsigned long int relocs;	// relocations created
+	unsigned long int syms;		// symbols in output symtab
+	unsigned long int written;	// bytes written to output
+	int cached;			// output fetched from the --cache
+} wstats_t;
+
+wstats_t wstats;
+
 /**
 * Convert BFD permissions into regular octal perms
 */
@@ -425,6 +604,151 @@ unsigned int protect_perms(unsigned int perms)
 	return memperms;
 }
 
+/**
+* Make sure a growable buffer can hold at least needed bytes.
+* Capacity is doubled (amortized O(1) appends) and new memory is zeroed.
+*/
+void *gbuf_reserve(gbuf_t *b, unsigned long int needed)
+{
+	unsigned long int newcap = 0;
+	char *p = 0;
+
+	if (needed <= b->cap) {
+		return *b->data;
+	}
+
+	newcap = b->cap ? b->cap : GBUF_MIN_SIZE;
+	while (newcap < needed) {
+		newcap *= 2;
+	}
+
+	p = realloc(*b->data, newcap);
+	if (!p) {
+		printf(" ERROR: realloc() %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	memset(p + b->cap, 0x00, newcap - b->cap);
+
+	gbuf_total += newcap - b->cap;
+	gbuf_inuse += newcap - b->cap;
+	if (gbuf_inuse > gbuf_peak) {
+		gbuf_peak = gbuf_inuse;
+	}
+
+	*b->data = p;
+	b->cap = newcap;
+	return p;
+}
+
+/**
+* Release a growable buffer
+*/
+void gbuf_free(gbuf_t *b)
+{
+	free(*b->data);
+	*b->data = 0;
+	gbuf_inuse -= b->cap;
+	b->cap = 0;
+}
+
+/**
+* Record a symbol value in the symbol table index
+*/
+void symindex_add_value(unsigned long long int value)
+{
+	symvalue_t *v = 0;
+
+	HASH_FIND(hh, symvalues, &value, sizeof(value), v);
+	if (!v) {
+		v = calloc(1, sizeof(symvalue_t));
+		if (!v) {
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+		v->value = value;
+		HASH_ADD(hh, symvalues, value, sizeof(value), v);
+	}
+	v->count++;
+}
+
+/**
+* Forget a symbol value from the symbol table index
+*/
+void symindex_del_value(unsigned long long int value)
+{
+	symvalue_t *v = 0;
+
+	HASH_FIND(hh, symvalues, &value, sizeof(value), v);
+	if ((v) && (--v->count == 0)) {
+		HASH_DEL(symvalues, v);
+		free(v);
+	}
+}
+
+/**
+* Return 1 if a symbol with this value is in the symbol table
+*/
+int symindex_has_value(unsigned long long int value)
+{
+	symvalue_t *v = 0;
+
+	HASH_FIND(hh, symvalues, &value, sizeof(value), v);
+	return v ? 1 : 0;
+}
+
+/**
+* Change the value of a symbol, keeping the symbol table index in sync
+*/
+void sym_set_value(Elf_Sym *s, unsigned long long int value)
+{
+	symindex_del_value(s->st_value);
+	s->st_value = value;
+	symindex_add_value(s->st_value);
+}
+
+/**
+* Index strings appended to the string table since last call.
+* Strings are walked from the start of globalstrtab exactly like a linear scan would.
+*/
+void strindex_update(void)
+{
+	symname_t *n = 0;
+	char *str = 0;
+	size_t len = 0;
+
+	while (symnamesoffset < globalstrtablen) {
+		str = globalstrtab + symnamesoffset;
+		len = strnlen(str, globalstrtablen - symnamesoffset);
+		if (symnamesoffset + len >= globalstrtablen) {
+			break;	// not terminated yet : wait for next append
+		}
+
+		HASH_FIND_STR(symnames, str, n);
+		if (!n) {
+			n = calloc(1, sizeof(symname_t));
+			if (!n) {
+				perror("calloc");
+				exit(EXIT_FAILURE);
+			}
+			n->name = strdup(str);
+			HASH_ADD_KEYPTR(hh, symnames, n->name, len, n);
+		}
+		symnamesoffset += len + 1;
+	}
+}
+
+/**
+* Return 1 if this string is in the string table
+*/
+int strindex_has_name(const char *name)
+{
+	symname_t *n = 0;
+
+	strindex_update();
+	HASH_FIND_STR(symnames, name, n);
+	return n ? 1 : 0;
+}
+
 /**
 * Add a new symbol to the symbol table
 */
@@ -433,18 +757,23 @@ void add_symaddr(ctx_t *ctx, const char *name, int addr, char symclass)
 	struct symaddr *sa = 0;
 	Elf_Sym *s = 0;
 	unsigned long int nameptr = 0;
+	unsigned long int value = 0;
 	unsigned int i = 0;
 
 	if (*name == '\0')
 		return;
 
+	// remember function starts : used to split .text between disassembly threads
+	if ((symclass == 'T') || (symclass == 't')) {
+		gbuf_reserve(&gbuf_funcstarts, funcstartslen + sizeof(unsigned long int));
+		*(unsigned long int *) (funcstarts + funcstartslen) = (unsigned long int) addr;
+		funcstartslen += sizeof(unsigned long int);
+	}
+
 	// search this address in symbol table : duplicates here trigger a NULL ptr dereference in ld
-	for (i = 0; i < globalsymtablen / sizeof(Elf_Sym); i++) {
-		s = (Elf_Sym *) (globalsymtab + i * sizeof(Elf_Sym));
-		//
-		if ((s->st_value == addr - textvma) && (s->st_value != 0)) {
-			return;	// already in symtab
-		}
+	value = addr - textvma;
+	if ((globalsymtab) && (value != 0) && (symindex_has_value((Elf_Addr) value))) {
+		return;	// already in symtab
 	}
 
 	// check if name is in blacklist
@@ -472,11 +801,9 @@ void add_symaddr(ctx_t *ctx, const char *name, int addr, char symclass)
 	* Append name to global string table
 	*/
 	if (globalstrtab == 0) {
-		globalstrtab = calloc(1, strlen(sa->name) + 3);
 		globalstrtablen++;	// Start with a null byte
-	} else {
-		globalstrtab = realloc(globalstrtab, globalstrtablen + strlen(sa->name) + 2);
 	}
+	gbuf_reserve(&gbuf_strtab, globalstrtablen + strlen(sa->name) + 2);
 	memcpy(globalstrtab + globalstrtablen, sa->name, strlen(sa->name) + 1);
 	nameptr = globalstrtablen;
 	globalstrtablen += strlen(sa->name) + 1;
@@ -485,12 +812,10 @@ void add_symaddr(ctx_t *ctx, const char *name, int addr, char symclass)
 	* Append symbol to global symbol table
 	*/
 	if (globalsymtab == 0) {
-		globalsymtab = calloc(1, sizeof(Elf_Sym) * 2);
-		memset(globalsymtab, 0x00, sizeof(Elf_Sym) * 2);
 		globalsymtablen += sizeof(Elf_Sym);	// Skip 1 NULL entry
-	} else {
-		globalsymtab = realloc(globalsymtab, sizeof(Elf_Sym) + globalsymtablen);
+		symindex_add_value(0);
 	}
+	gbuf_reserve(&gbuf_symtab, globalsymtablen + sizeof(Elf_Sym));
 
 	s = (Elf_Sym *) (globalsymtab + globalsymtablen);
 	s->st_name = nameptr;
@@ -544,6 +869,7 @@ void add_symaddr(ctx_t *ctx, const char *name, int addr, char symclass)
 		s->st_info += 0x10;
 	}
 
+	symindex_add_value(s->st_value);
 	globalsymtablen += sizeof(Elf_Sym);
 	return;
 }
@@ -1050,118 +1376,283 @@ unsigned int max(unsigned int a, unsigned int b)
 }
 
 /**
-* Return a section from its name
+* Return 1 if a section is kept when stripping the binary
 */
-msec_t *section_from_name(ctx_t *ctx, char *name)
+int is_allowed_section(msec_t *s)
 {
-	msec_t *s = 0;
+	unsigned int j = 0;
 
-	DL_FOREACH(ctx->mshdrs, s) {
-		if (str_eq(s->name, name)) {
-			return s;
+	for (j = 0; j < sizeof(allowed_sections) / sizeof(char *); j++) {
+		if (str_eq(s->name, allowed_sections[j])) {
+			return 1;
 		}
 	}
 	return 0;
 }
 
 /**
-* Return a section from its address
+* Build sorted, non overlapping address ranges from sections.
+* When sections overlap, an address belongs to the first one in ctx->mshdrs,
+* which is what a linear walk of the list would return.
+* If use_elf_size is set, ranges span sh_size bytes instead of the BFD size.
 */
-    msec_t * section_from_addr(ctx_t *ctx, unsigned long int addr)
+secrange_t *build_section_ranges(ctx_t *ctx, int use_elf_size, unsigned int *nranges)
 {
 	msec_t *s = 0;
+	msec_t **secs = 0;
+	unsigned long int *bounds = 0;
+	unsigned long int start = 0, end = 0, size = 0;
+	secrange_t *ranges = 0;
+	unsigned int nsecs = 0, nbounds = 0, n = 0;
+	unsigned int i = 0, j = 0, k = 0;
+
+	DL_COUNT(ctx->mshdrs, s, n);
+	secs = calloc(n + 1, sizeof(msec_t *));
+	bounds = calloc(2 * n + 1, sizeof(unsigned long int));
+	ranges = calloc(2 * n + 1, sizeof(secrange_t));
+	if ((!secs) || (!bounds) || (!ranges)) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
 
+	// keep mapped sections, in list order
 	DL_FOREACH(ctx->mshdrs, s) {
-		if ((s->s_bfd->vma) && (s->s_bfd->vma <= addr)
-		    && (s->s_bfd->vma + s->s_bfd->size > addr)) {
-			return s;
+		if ((!s->s_bfd) || (!s->s_bfd->vma)) {
+			continue;
+		}
+		size = use_elf_size ? (s->s_elf ? s->s_elf->sh_size : 0) : s->s_bfd->size;
+		if (!size) {
+			continue;
 		}
+		secs[nsecs++] = s;
+		bounds[nbounds++] = s->s_bfd->vma;
+		bounds[nbounds++] = s->s_bfd->vma + size;
 	}
-	return 0;
+
+	// sort and deduplicate range boundaries
+	for (i = 1; i < nbounds; i++) {
+		for (j = i; (j > 0) && (bounds[j - 1] > bounds[j]); j--) {
+			unsigned long int tmp = bounds[j];
+			bounds[j] = bounds[j - 1];
+			bounds[j - 1] = tmp;
+		}
+	}
+	for (i = 0, j = 0; i < nbounds; i++) {
+		if ((j == 0) || (bounds[j - 1] != bounds[i])) {
+			bounds[j++] = bounds[i];
+		}
+	}
+	nbounds = j;
+
+	// assign each elementary range to its first covering section, merge neighbours
+	*nranges = 0;
+	for (i = 0; i + 1 < nbounds; i++) {
+		start = bounds[i];
+		end = bounds[i + 1];
+		for (k = 0; k < nsecs; k++) {
+			size = use_elf_size ? secs[k]->s_elf->sh_size : secs[k]->s_bfd->size;
+			if ((secs[k]->s_bfd->vma <= start) && (secs[k]->s_bfd->vma + size >= end)) {
+				break;
+			}
+		}
+		if (k == nsecs) {
+			continue;	// hole between sections
+		}
+
+		if ((*nranges) && (ranges[*nranges - 1].sec == secs[k]) && (ranges[*nranges - 1].end == start)) {
+			ranges[*nranges - 1].end = end;
+		} else {
+			ranges[*nranges].start = start;
+			ranges[*nranges].end = end;
+			ranges[*nranges].sec = secs[k];
+			(*nranges)++;
+		}
+	}
+
+	free(secs);
+	free(bounds);
+	return ranges;
 }
 
 /**
-* Return a section from its index
+* Binary search an address in sorted section ranges
 */
-msec_t *section_from_index(ctx_t *ctx, unsigned int index)
+msec_t *section_from_ranges(secrange_t *ranges, unsigned int nranges, unsigned long int addr)
 {
-	msec_t *s = 0;
-	unsigned int i = 1;	// We count from 1
-	DL_FOREACH(ctx->mshdrs, s) {
-		if (index == i) {
-			return s;
+	unsigned int lo = 0, hi = nranges, mid = 0;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (addr < ranges[mid].start) {
+			hi = mid;
+		} else if (addr >= ranges[mid].end) {
+			lo = mid + 1;
+		} else {
+			return ranges[mid].sec;
 		}
-		i++;
 	}
 	return 0;
 }
 
 /**
-* Return a section index from its name
+* Release the section lookup index (call whenever ctx->mshdrs changes)
 */
-unsigned int secindex_from_name(ctx_t *ctx, const char *name)
+void free_section_index(ctx_t *ctx)
 {
-	msec_t *s = 0;
-	unsigned int i = 1;	// We count from 1
+	secidx_t *idx = ctx->secidx;
+	secname_t *n = 0, *tmp = 0;
 
-	DL_FOREACH(ctx->mshdrs, s) {
-		if (str_eq(s->name, name)) {
-			return i;
-		}
-		i++;
+	if (!idx) {
+		return;
 	}
-	return 0;
+
+	HASH_ITER(hh, idx->names, n, tmp) {
+		HASH_DEL(idx->names, n);
+		free(n);
+	}
+	free(idx->byindex);
+	free(idx->allowed);
+	free(idx->ranges);
+	free(idx);
+	ctx->secidx = 0;
 }
 
 /**
-* Return a section index (after strip) from its name
+* Build section lookup index : by index, by name and by address
 */
-unsigned int secindex_from_name_after_strip(ctx_t *ctx, const char *name)
+secidx_t *build_section_index(ctx_t *ctx)
 {
+	secidx_t *idx = 0;
+	secname_t *n = 0;
 	msec_t *s = 0;
-	unsigned int i = 1;	// We count from 1
-	unsigned int j = 0;
+	unsigned int count = 0;
+
+	free_section_index(ctx);
+
+	idx = calloc(1, sizeof(secidx_t));
+	if (!idx) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+	DL_COUNT(ctx->mshdrs, s, count);
+	idx->byindex = calloc(count + 1, sizeof(msec_t *));
+	idx->allowed = calloc(count + 1, sizeof(msec_t *));
+	if ((!idx->byindex) || (!idx->allowed)) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
 
 	DL_FOREACH(ctx->mshdrs, s) {
-		if (str_eq(s->name, name)) {
-			return i;
-		}
+		idx->byindex[idx->nsec++] = s;
 
-		for (j = 0; j < sizeof(allowed_sections) / sizeof(char *); j++) {
-			if (str_eq(s->name, allowed_sections[j])) {
-				i++;	// Ok, this section is allowed
-				break;
+		HASH_FIND_STR(idx->names, s->name, n);
+		if (!n) {	// first section with this name wins
+			n = calloc(1, sizeof(secname_t));
+			if (!n) {
+				perror("calloc");
+				exit(EXIT_FAILURE);
 			}
+			n->name = s->name;
+			n->sec = s;
+			n->index = idx->nsec;
+			n->index_after_strip = idx->nallowed + 1;
+			HASH_ADD_KEYPTR(hh, idx->names, n->name, strlen(n->name), n);
+		}
+
+		if (is_allowed_section(s)) {
+			idx->allowed[idx->nallowed++] = s;
 		}
 	}
-	return 0;
+
+	idx->ranges = build_section_ranges(ctx, 0, &idx->nranges);
+
+	ctx->secidx = idx;
+	return idx;
 }
 
 /**
-* Return a section name from its index in section header table
+* Return section lookup index, (re)building it if needed
 */
-char *sec_name_from_index_after_strip(ctx_t *ctx, unsigned int index)
+secidx_t *section_index(ctx_t *ctx)
 {
+	return ctx->secidx ? ctx->secidx : build_section_index(ctx);
+}
 
-	msec_t *s = 0;
-	unsigned int i = 0;
-	unsigned int j = 0;
+/**
+* Return a section from its name
+*/
+msec_t *section_from_name(ctx_t *ctx, char *name)
+{
+	secname_t *n = 0;
 
-	DL_FOREACH(ctx->mshdrs, s) {
+	HASH_FIND_STR(section_index(ctx)->names, name, n);
+	return n ? n->sec : 0;
+}
 
-		for (j = 0; j < sizeof(allowed_sections) / sizeof(char *); j++) {
-			if (str_eq(s->name, allowed_sections[j])) {
-				i++;	// Ok, this section is allowed
-				break;
-			}
-		}
+/**
+* Return a section from its address
+*/
+msec_t *section_from_addr(ctx_t *ctx, unsigned long int addr)
+{
+	secidx_t *idx = section_index(ctx);
+
+	return section_from_ranges(idx->ranges, idx->nranges, addr);
+}
+
+/**
+* Return a section from its index
+*/
+msec_t *section_from_index(ctx_t *ctx, unsigned int index)
+{
+	secidx_t *idx = section_index(ctx);
+
+	if ((index == 0) || (index > idx->nsec)) {	// We count from 1
+		return 0;
+	}
+	return idx->byindex[index - 1];
+}
+
+/**
+* Return a section index from its name
+*/
+unsigned int secindex_from_name(ctx_t *ctx, const char *name)
+{
+	secname_t *n = 0;
+
+	HASH_FIND_STR(section_index(ctx)->names, name, n);
+	return n ? n->index : 0;
+}
+
+/**
+* Return a section index (after strip) from its name
+*/
+unsigned int secindex_from_name_after_strip(ctx_t *ctx, const char *name)
+{
+	secname_t *n = 0;
+
+	HASH_FIND_STR(section_index(ctx)->names, name, n);
+	return n ? n->index_after_strip : 0;
+}
+
+/**
+* Return a section name from its index in section header table
+*/
+char *sec_name_from_index_after_strip(ctx_t *ctx, unsigned int index)
+{
+	secidx_t *idx = section_index(ctx);
 
-		if (i == index) {
-			return s->name;
+	if (index == 0) {	// only a leading non allowed section has index 0
+		if ((idx->nsec) && (!is_allowed_section(idx->byindex[0]))) {
+			return idx->byindex[0]->name;
 		}
+		return NULL;
+	}
 
+	if (index > idx->nallowed) {
+		return NULL;
 	}
-	return NULL;
+	return idx->allowed[index - 1]->name;
 }
 
 /**
@@ -1591,28 +2082,226 @@ static unsigned int mk_phdrs(ctx_t *ctx)
 }
 
 /**
-* Write Program Headers to disk
+* Grow output image to hold at least size bytes.
+* data is anonymous memory : zero filled, and only resident once written.
 */
-static unsigned int write_phdrs(ctx_t *ctx)
+static void out_reserve(outimg_t *img, unsigned long size)
 {
-	unsigned int tmpm = 0;
+	unsigned long newcap = 0, p = 0;
+	void *data = MAP_FAILED;
 
-	// Goto end of file, align on 8 bytes boundaries
-	tmpm = lseek(ctx->fdout, 0x00, SEEK_END);
-	write(ctx->fdout, nullstr, 20);
-	if ((tmpm % 8) == 0) {
-		tmpm += 8;
+	if (size <= img->cap) {
+		return;
 	}
-	tmpm &= ~0xf;
-	tmpm += sizeof(Elf_Phdr);	// Prepend NULL section
-	ftruncate(ctx->fdout, tmpm);
-
-	ctx->start_phdrs = lseek(ctx->fdout, 0x00, SEEK_END);
 
-	ctx->phnum += 2;
+	newcap = img->cap ? img->cap : OUT_PAGE_SIZE;
+	while (newcap < size) {
+		newcap *= 2;
+	}
 
-	if (ctx->opt_verbose) {
-		printf(" -- Writing %u segment headers\n", ctx->phnum);
+	if (img->data) {
+		data = mremap(img->data, img->cap, newcap, MREMAP_MAYMOVE);
+	} else {
+		data = mmap(NULL, newcap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	}
+	if (data == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	img->data = data;
+
+	img->dirty = realloc(img->dirty, newcap >> OUT_PAGE_SHIFT);
+	if (!img->dirty) {
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+
+	// pages past the input binary never come from it
+	for (p = img->cap >> OUT_PAGE_SHIFT; p < newcap >> OUT_PAGE_SHIFT; p++) {
+		img->dirty[p] = (p << OUT_PAGE_SHIFT) >= img->origsz;
+	}
+	img->cap = newcap;
+}
+
+/**
+* Load the input pages overlapping [start, end),
+* skipping those about to be entirely overwritten if overwrite is set
+*/
+static void out_materialize(outimg_t *img, unsigned long start, unsigned long end, int overwrite)
+{
+	unsigned long p = 0, off = 0, n = 0;
+
+	for (p = start >> OUT_PAGE_SHIFT; (p << OUT_PAGE_SHIFT) < end; p++) {
+		if (img->dirty[p]) {
+			continue;
+		}
+		off = p << OUT_PAGE_SHIFT;
+		img->dirty[p] = 1;
+		if ((overwrite) && (off >= start) && (off + OUT_PAGE_SIZE <= end)) {
+			continue;	// no need to read it
+		}
+		n = img->origsz - off < OUT_PAGE_SIZE ? img->origsz - off : OUT_PAGE_SIZE;
+		if (pread(img->fdin, img->data + off, n, off) != (ssize_t) n) {
+			printf(" ERROR: pread() %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/**
+* Write to output image at the current offset
+*/
+static ssize_t out_write(ctx_t *ctx, const void *buf, size_t n)
+{
+	outimg_t *img = ctx->out;
+
+	out_reserve(img, img->pos + n);
+	out_materialize(img, img->pos, img->pos + n, 1);
+	memcpy(img->data + img->pos, buf, n);
+	img->pos += n;
+	if (img->pos > img->len) {
+		img->len = img->pos;
+	}
+	return n;
+}
+
+/**
+* Set current offset in output image
+*/
+static off_t out_seek(ctx_t *ctx, off_t off, int whence)
+{
+	outimg_t *img = ctx->out;
+
+	img->pos = (whence == SEEK_END) ? img->len + off : (unsigned long) off;
+	return img->pos;
+}
+
+/**
+* Set output image size
+*/
+static int out_truncate(ctx_t *ctx, off_t len)
+{
+	outimg_t *img = ctx->out;
+	unsigned long l = len, p = 0;
+
+	out_reserve(img, l);
+	if (l < img->len) {
+		// bytes past the end read back as zeros if the file grows again
+		out_materialize(img, l & ~(OUT_PAGE_SIZE - 1), l, 0);
+		memset(img->data + l, 0x00, img->len - l);
+		for (p = l >> OUT_PAGE_SHIFT; (p << OUT_PAGE_SHIFT) < img->len; p++) {
+			img->dirty[p] = 1;
+		}
+	}
+	img->len = l;
+	return 0;
+}
+
+/**
+* Write [off, off + n) of output image to disk
+*/
+static unsigned int out_pwrite(ctx_t *ctx, unsigned long off, unsigned long n)
+{
+	outimg_t *img = ctx->out;
+	unsigned int calls = 0;
+	ssize_t ret = 0;
+
+	while (n) {
+		ret = pwrite(ctx->fdout, img->data + off, n, off);
+		calls++;
+		if (ret <= 0) {
+			printf(" ERROR: pwrite() %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		off += ret;
+		n -= ret;
+		wstats.written += ret;
+	}
+	return calls;
+}
+
+/**
+* Write output image to disk : ranges never written to are copied from the input binary in kernel space
+*/
+static int out_flush(ctx_t *ctx)
+{
+	outimg_t *img = ctx->out;
+	unsigned long p = 0, q = 0, npages = 0, off = 0, end = 0;
+	loff_t inoff = 0, outoff = 0;
+	unsigned long copied = 0;
+	unsigned int calls = 1;
+	ssize_t ret = 0;
+
+	if (ftruncate(ctx->fdout, img->len)) {
+		printf(" ERROR: ftruncate() %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	npages = (img->len + OUT_PAGE_SIZE - 1) >> OUT_PAGE_SHIFT;
+	for (p = 0; p < npages; p = q) {
+		// coalesce pages with the same state
+		for (q = p + 1; (q < npages) && (img->dirty[q] == img->dirty[p]); q++);
+
+		off = p << OUT_PAGE_SHIFT;
+		end = (q << OUT_PAGE_SHIFT) < img->len ? q << OUT_PAGE_SHIFT : img->len;
+
+		if (img->dirty[p]) {
+			calls += out_pwrite(ctx, off, end - off);
+			continue;
+		}
+
+		inoff = outoff = off;
+		while (outoff < (loff_t) end) {
+			ret = copy_file_range(img->fdin, &inoff, ctx->fdout, &outoff, end - outoff, 0);
+			calls++;
+			if (ret <= 0) {
+				break;
+			}
+			copied += ret;
+			wstats.written += ret;
+		}
+		if (outoff < (loff_t) end) {
+			// copy_file_range() unsupported (or short input) : write from memory
+			out_materialize(img, outoff, end, 0);
+			calls += out_pwrite(ctx, outoff, end - outoff);
+		}
+	}
+
+	if (ctx->opt_verbose) {
+		printf(" -- Output: %lu bytes (%lu copied from input) in %u system calls\n", img->len, copied, calls);
+	}
+
+	close(img->fdin);
+	munmap(img->data, img->cap);
+	free(img->dirty);
+	free(img);
+	ctx->out = 0;
+	return 0;
+}
+
+/**
+* Write Program Headers to disk
+*/
+static unsigned int write_phdrs(ctx_t *ctx)
+{
+	unsigned int tmpm = 0;
+
+	// Goto end of file, align on 8 bytes boundaries
+	tmpm = out_seek(ctx, 0x00, SEEK_END);
+	out_write(ctx, nullstr, 20);
+	if ((tmpm % 8) == 0) {
+		tmpm += 8;
+	}
+	tmpm &= ~0xf;
+	tmpm += sizeof(Elf_Phdr);	// Prepend NULL section
+	out_truncate(ctx, tmpm);
+
+	ctx->start_phdrs = out_seek(ctx, 0x00, SEEK_END);
+
+	ctx->phnum += 2;
+
+	if (ctx->opt_verbose) {
+		printf(" -- Writing %u segment headers\n", ctx->phnum);
 	}
 
 	// first entry is the program header itself
@@ -1625,12 +2314,12 @@ static unsigned int write_phdrs(ctx_t *ctx)
 	phdr->p_filesz = ctx->phnum * sizeof(Elf_Phdr);
 	phdr->p_memsz = ctx->phnum * sizeof(Elf_Phdr);
 	phdr->p_align = 8;
-	write(ctx->fdout, phdr, sizeof(Elf_Phdr));
+	out_write(ctx, phdr, sizeof(Elf_Phdr));
 
 	// Copy all the Phdrs
 	mseg_t *p;
 	DL_FOREACH(ctx->mphdrs, p) {
-		write(ctx->fdout, p, sizeof(Elf_Phdr));
+		out_write(ctx, p, sizeof(Elf_Phdr));
 	}
 
 	// Append a Program Header for the stack
@@ -1642,7 +2331,7 @@ static unsigned int write_phdrs(ctx_t *ctx)
 	phdr->p_filesz = 0;
 	phdr->p_memsz = 0;
 	phdr->p_align = 0x10;
-	write(ctx->fdout, phdr, sizeof(Elf_Phdr));
+	out_write(ctx, phdr, sizeof(Elf_Phdr));
 
 	return ctx->start_phdrs;
 }
@@ -1655,16 +2344,16 @@ static unsigned int write_phdrs_original(ctx_t *ctx)
 	unsigned int tmpm = 0;
 
 	// Goto end of file, align on 8 bytes boundaries
-	tmpm = lseek(ctx->fdout, 0x00, SEEK_END);
-	write(ctx->fdout, nullstr, 20);
+	tmpm = out_seek(ctx, 0x00, SEEK_END);
+	out_write(ctx, nullstr, 20);
 	if ((tmpm % 8) == 0) {
 		tmpm += 8;
 	}
 	tmpm &= ~0xf;
 
-	ftruncate(ctx->fdout, tmpm);
+	out_truncate(ctx, tmpm);
 
-	ctx->start_phdrs = lseek(ctx->fdout, 0x00, SEEK_END);
+	ctx->start_phdrs = out_seek(ctx, 0x00, SEEK_END);
 
 	mseg_t *p;
 	unsigned int i = 0;
@@ -1673,7 +2362,7 @@ static unsigned int write_phdrs_original(ctx_t *ctx)
 			p->p_offset = ctx->start_phdrs;	// Patch offset of Program header
 			i = 1;
 		}
-		write(ctx->fdout, p, sizeof(Elf_Phdr));
+		out_write(ctx, p, sizeof(Elf_Phdr));
 	}
 	return ctx->start_phdrs;
 }
@@ -1714,8 +2403,8 @@ static int write_strtab_and_reloc(ctx_t *ctx)
 	}
 
 	// Goto end of file
-	tmpm = lseek(ctx->fdout, 0x00, SEEK_END);
-	write(ctx->fdout, nullstr, 20);
+	tmpm = out_seek(ctx, 0x00, SEEK_END);
+	out_write(ctx, nullstr, 20);
 
 	// align on 8 bytes boundaries
 	if ((tmpm % 8) == 0) {
@@ -1724,28 +2413,28 @@ static int write_strtab_and_reloc(ctx_t *ctx)
 	tmpm &= ~0xf;
 
 	// truncate
-	ftruncate(ctx->fdout, tmpm);
+	out_truncate(ctx, tmpm);
 
 	// write .text relocations to binary
-	tmpm = lseek(ctx->fdout, 0x00, SEEK_END);
+	tmpm = out_seek(ctx, 0x00, SEEK_END);
 	globalrelocoffset = tmpm;
-	write(ctx->fdout, globalreloc, globalreloclen);
+	out_write(ctx, globalreloc, globalreloclen);
 
 	// write .data relocations to binary
-	tmpm = lseek(ctx->fdout, 0x00, SEEK_END);
+	tmpm = out_seek(ctx, 0x00, SEEK_END);
 	globaldatarelocoffset = tmpm;
-	write(ctx->fdout, globaldatareloc, globaldatareloclen);
+	out_write(ctx, globaldatareloc, globaldatareloclen);
 
 	// write string table to binary
-	tmpm = lseek(ctx->fdout, 0x00, SEEK_END);
+	tmpm = out_seek(ctx, 0x00, SEEK_END);
 	globalstrtableoffset = tmpm;
-	write(ctx->fdout, globalstrtab, globalstrtablen);
+	out_write(ctx, globalstrtab, globalstrtablen);
 
 	// write symbol table to binary
-	tmpm = lseek(ctx->fdout, 0x00, SEEK_END);
+	tmpm = out_seek(ctx, 0x00, SEEK_END);
 	globalsymtableoffset = tmpm;
 	memset(globalsymtab, 0x00, sizeof(Elf_Sym));	// Make sure first entry is NULL        
-	write(ctx->fdout, globalsymtab, globalsymtablen);
+	out_write(ctx, globalsymtab, globalsymtablen);
 
 	return 0;
 }
@@ -2131,7 +2820,8 @@ int fixup_strtab_and_symtab(ctx_t *ctx)
 				}
 
 				// generate new symbol name from old one
-				globalstrtab = realloc(globalstrtab, globalstrtablen + strlen(sname) + 5);
+				gbuf_reserve(&gbuf_strtab, globalstrtablen + strlen(sname) + 5);
+				sname = (char *) (globalstrtab + s->st_name);	// buffer may have moved
 				sprintf(globalstrtab + globalstrtablen, "old_%s", sname);
 				s->st_name = globalstrtablen;
 				globalstrtablen += strlen(globalstrtab + globalstrtablen) + 1;
@@ -2149,10 +2839,10 @@ int fixup_strtab_and_symtab(ctx_t *ctx)
 		*/
 		if ((s->st_value) && (s->st_value >= mintext) && (s->st_value <= maxtext)) {
 			printf(" * adjusting .TEXT symbol: %s\n", (char *) (globalstrtab + s->st_name));
-			s->st_value -= textvma;
+			sym_set_value(s, s->st_value - textvma);
 		} else if (s->st_value) {
 			printf(" * adjusting .DATA symbol: %s\n", (char *) (globalstrtab + s->st_name));
-			s->st_value -= datavma;
+			sym_set_value(s, s->st_value - datavma);
 		} else if (!s->st_value) {
 			printf(" * no adjustment symbol: %s\n", (char *) (globalstrtab + s->st_name));
 		}
@@ -2195,7 +2885,7 @@ int fixup_text(ctx_t *ctx)
 			s->s_elf->sh_offset = orig_sz;
 			s->outoffset = orig_sz;
 			// extend output file
-			ftruncate(ctx->fdout, s->outoffset + s->s_elf->sh_size);
+			out_truncate(ctx, s->outoffset + s->s_elf->sh_size);
 			s->len = newsz;
 			break;
 		}
@@ -2236,14 +2926,13 @@ unsigned int append_sym(Elf_Sym *s)
 	printf(" -- global symtab length: %u\n", globalsymtablen);
 
 	if (globalsymtab == 0) {
-		globalsymtab = calloc(1, sizeof(Elf_Sym) * 2);
-		memset(globalsymtab, 0x00, sizeof(Elf_Sym) * 2);
 		globalsymtablen += sizeof(Elf_Sym);	// Skip 1 NULL entry
-	} else {
-		globalsymtab = realloc(globalsymtab, sizeof(Elf_Sym) + globalsymtablen);
+		symindex_add_value(0);
 	}
+	gbuf_reserve(&gbuf_symtab, globalsymtablen + sizeof(Elf_Sym));
 
 	memcpy(globalsymtab + globalsymtablen, s, sizeof(Elf_Sym));
+	symindex_add_value(s->st_value);
 
 	globalsymtablen += sizeof(Elf_Sym);
 
@@ -2259,11 +2948,9 @@ unsigned int append_strtab(char *str)
 	unsigned int nameptr = 0;
 
 	if (globalstrtab == 0) {
-		globalstrtab = calloc(1, strlen(str) + 3);
 		globalstrtablen++;	// Start with a null byte
-	} else {
-		globalstrtab = realloc(globalstrtab, globalstrtablen + strlen(str) + 2);
 	}
+	gbuf_reserve(&gbuf_strtab, globalstrtablen + strlen(str) + 2);
 	memcpy(globalstrtab + globalstrtablen, str, strlen(str) + 1);
 	nameptr = globalstrtablen;
 	globalstrtablen += strlen(str) + 1;
@@ -2373,7 +3060,13 @@ static unsigned int process_text(ctx_t *ctx)
 	delta = orig_text - textvma;
 
 	// parse text for relocations
-	analyze_text(ctx, (char *) (t->data + delta), maxtext - mintext - delta, orig_text);
+	if (ctx->opt_jobs > 1) {
+		analyze_text_parallel(ctx, (char *) (t->data + delta), maxtext - mintext - delta, orig_text);
+	} else if (ctx->opt_stream) {
+		analyze_text_stream(ctx, (char *) (t->data + delta), maxtext - mintext - delta, orig_text);
+	} else {
+		analyze_text(ctx, (char *) (t->data + delta), maxtext - mintext - delta, orig_text);
+	}
 
 	return 0;
 }
@@ -2400,13 +3093,8 @@ static unsigned int create_rela_data_rel_ro_local_entry(unsigned int section_num
 {
 	Elf64_Rela *r = 0;
 
-	if (rela_data_rel_ro_local_len == 0) {
-		rela_data_rel_ro_local = calloc(1, sizeof(Elf64_Rela));
-		r = (Elf64_Rela *)rela_data_rel_ro_local;
-	} else {
-		rela_data_rel_ro_local = realloc(rela_data_rel_ro_local, rela_data_rel_ro_local_len + sizeof(Elf64_Rela));
-		r = (Elf64_Rela *)(rela_data_rel_ro_local + rela_data_rel_ro_local_len);
-	}
+	gbuf_reserve(&gbuf_rela_data_rel_ro_local, rela_data_rel_ro_local_len + sizeof(Elf64_Rela));
+	r = (Elf64_Rela *)(rela_data_rel_ro_local + rela_data_rel_ro_local_len);
 
 	r->r_offset = offset;
 	r->r_info = 0x0000000200000001;	// 3rd section, type: R_X86_64_64
@@ -2443,6 +3131,7 @@ static unsigned int process_data_rel_ro(ctx_t *ctx)
 
 		// Rename .data.rel.ro to .data.rel.ro.local
 		t->name = strdup(".data.rel.ro.local");
+		free_section_index(ctx);
 
 		// Parse section
 		for (i = 0; i < t->len; i += 8) {
@@ -2486,11 +3175,11 @@ static unsigned int write_shdrs(ctx_t *ctx)
 	* Align section headers on 8 bytes boundaries
 	*/
 	// Goto end of file
-	tmpm = lseek(ctx->fdout, 0x00, SEEK_END);
-	write(ctx->fdout, nullstr, 20);
-	write(ctx->fdout, nullstr, 20);
-	write(ctx->fdout, nullstr, 20);
-	tmpm = lseek(ctx->fdout, 0x00, SEEK_END);
+	tmpm = out_seek(ctx, 0x00, SEEK_END);
+	out_write(ctx, nullstr, 20);
+	out_write(ctx, nullstr, 20);
+	out_write(ctx, nullstr, 20);
+	tmpm = out_seek(ctx, 0x00, SEEK_END);
 
 	// align on 8 bytes boundaries
 	if ((tmpm % 8) == 0) {
@@ -2502,11 +3191,11 @@ static unsigned int write_shdrs(ctx_t *ctx)
 		* Write content of section .rela.data.rel.ro.local
 		*/
 		// truncate
-		ftruncate(ctx->fdout, tmpm);
-		tmpm = lseek(ctx->fdout, 0x00, SEEK_END);
+		out_truncate(ctx, tmpm);
+		tmpm = out_seek(ctx, 0x00, SEEK_END);
 		rela_data_rel_ro_local_offset = tmpm;
-		write(ctx->fdout, rela_data_rel_ro_local, rela_data_rel_ro_local_len);
-		tmpm = lseek(ctx->fdout, 0x00, SEEK_END);
+		out_write(ctx, rela_data_rel_ro_local, rela_data_rel_ro_local_len);
+		tmpm = out_seek(ctx, 0x00, SEEK_END);
 
 
 		// align on 8 bytes boundaries
@@ -2520,9 +3209,9 @@ static unsigned int write_shdrs(ctx_t *ctx)
 	tmpm += sizeof(Elf_Shdr);	// Prepend a NULL section
 
 	// truncate
-	ftruncate(ctx->fdout, tmpm);
+	out_truncate(ctx, tmpm);
 
-	ctx->start_shdrs = lseek(ctx->fdout, 0x00, SEEK_END) - sizeof(Elf_Shdr);	// New start of SHDRs
+	ctx->start_shdrs = out_seek(ctx, 0x00, SEEK_END) - sizeof(Elf_Shdr);	// New start of SHDRs
 	ctx->strndx[0] = 0;
 	ctx->strndx_len = 1;
 
@@ -2546,7 +3235,7 @@ static unsigned int write_shdrs(ctx_t *ctx)
 		s->s_elf->sh_info = info_from_name(ctx, s->name);	// Additional section information
 
 		// write section header to binary
-		write(ctx->fdout, s->s_elf, sizeof(Elf_Shdr));
+		out_write(ctx, s->s_elf, sizeof(Elf_Shdr));
 	}
 
 	if (rela_data_rel_ro_local_len) {
@@ -2558,7 +3247,7 @@ static unsigned int write_shdrs(ctx_t *ctx)
 		// append name to strndx
 		memcpy(ctx->strndx + ctx->strndx_len, ".rela.data.rel.ro.local", 24);
 
-		tmpm = lseek(ctx->fdout, 0x00, SEEK_END);
+		tmpm = out_seek(ctx, 0x00, SEEK_END);
 
 		shdr = calloc(1, sizeof(Elf_Shdr));
 
@@ -2576,7 +3265,7 @@ static unsigned int write_shdrs(ctx_t *ctx)
 		ctx->strndx_len += 24;
 
 		// append string table section header to binary
-		write(ctx->fdout, shdr, sizeof(Elf_Shdr));
+		out_write(ctx, shdr, sizeof(Elf_Shdr));
 		free(shdr);
 		ctx->shnum++;
 		maxsec++;
@@ -2593,7 +3282,7 @@ static unsigned int write_shdrs(ctx_t *ctx)
 	// append name to strndx
 	memcpy(ctx->strndx + ctx->strndx_len, ".note.GNU-stack", 16);
 
-	tmpm = lseek(ctx->fdout, 0x00, SEEK_END);
+	tmpm = out_seek(ctx, 0x00, SEEK_END);
 
 	shdr = calloc(1, sizeof(Elf_Shdr));
 
@@ -2611,7 +3300,7 @@ static unsigned int write_shdrs(ctx_t *ctx)
 	ctx->strndx_len += 16;
 
 	// append string table section header to binary
-	write(ctx->fdout, shdr, sizeof(Elf_Shdr));
+	out_write(ctx, shdr, sizeof(Elf_Shdr));
 	free(shdr);
 	ctx->shnum++;
 	maxsec++;
@@ -2641,12 +3330,12 @@ static unsigned int write_shdrs(ctx_t *ctx)
 	ctx->strndx_len += 10;
 
 	// append string table section header to binary
-	write(ctx->fdout, shdr, sizeof(Elf_Shdr));
+	out_write(ctx, shdr, sizeof(Elf_Shdr));
 	free(shdr);
 
 	ctx->strndx_index = ctx->shnum + 1;
 	// append sections string table to binary
-	//  write(ctx->fdout, ctx->strndx, ctx->strndx_len);
+	//  out_write(ctx, ctx->strndx, ctx->strndx_len);
 
 	/**
 	* Add a section header for .data relocations
@@ -2671,7 +3360,7 @@ static unsigned int write_shdrs(ctx_t *ctx)
 	ctx->strndx_len += 10;
 
 	// append string table section header to binary
-	write(ctx->fdout, shdr, sizeof(Elf_Shdr));
+	out_write(ctx, shdr, sizeof(Elf_Shdr));
 	free(shdr);
 
 	ctx->shnum++;
@@ -2701,7 +3390,7 @@ static unsigned int write_shdrs(ctx_t *ctx)
 	ctx->strndx_len += 8;
 
 	// append string table section header to binary
-	write(ctx->fdout, shdr, sizeof(Elf_Shdr));
+	out_write(ctx, shdr, sizeof(Elf_Shdr));
 	free(shdr);
 
 	ctx->strndx_index = ctx->shnum + 1;
@@ -2728,7 +3417,7 @@ static unsigned int write_shdrs(ctx_t *ctx)
 	ctx->strndx_len += 8;
 
 	// append string table section header to binary
-	write(ctx->fdout, shdr, sizeof(Elf_Shdr));
+	out_write(ctx, shdr, sizeof(Elf_Shdr));
 	free(shdr);
 
 	ctx->strndx_index = ctx->shnum + 1;
@@ -2746,7 +3435,7 @@ static unsigned int write_shdrs(ctx_t *ctx)
 	shdr->sh_type = SHT_STRTAB;				// Section type
 	shdr->sh_flags = 0;					// Section flags
 	shdr->sh_addr = 0;					// Section virtual addr at execution
-	shdr->sh_offset = lseek(ctx->fdout, 0x00, SEEK_END) + sizeof(Elf_Shdr);	// Section file offset
+	shdr->sh_offset = out_seek(ctx, 0x00, SEEK_END) + sizeof(Elf_Shdr);	// Section file offset
 	shdr->sh_size = ctx->strndx_len + 10;			// Section size in bytes
 	shdr->sh_link = 0;					// Link to another section
 	shdr->sh_info = 0;					// Additional section information
@@ -2756,12 +3445,12 @@ static unsigned int write_shdrs(ctx_t *ctx)
 	ctx->strndx_len += 9 + 1;
 
 	// append string table section header to binary
-	write(ctx->fdout, shdr, sizeof(Elf_Shdr));
+	out_write(ctx, shdr, sizeof(Elf_Shdr));
 	free(shdr);
 
 	ctx->strndx_index = ctx->shnum + 1;
 	// append sections strint table to binary
-	write(ctx->fdout, ctx->strndx, ctx->strndx_len);
+	out_write(ctx, ctx->strndx, ctx->strndx_len);
 
 	if (ctx->opt_debug) {
 		printf(" * section headers at:\t\t\t0x%x\n", ctx->start_shdrs);
@@ -2837,8 +3526,8 @@ static int mk_ehdr(ctx_t *ctx)
 	}
 
 	// write ELF Header
-	lseek(ctx->fdout, 0x00, SEEK_SET);
-	write(ctx->fdout, e, sizeof(Elf_Ehdr));
+	out_seek(ctx, 0x00, SEEK_SET);
+	out_write(ctx, e, sizeof(Elf_Ehdr));
 	return 0;
 }
 
@@ -2850,10 +3539,10 @@ static int write_section(ctx_t *ctx, msec_t *m)
 	unsigned int nwrite = 0;
 
 	// Go to correct offset in output binary
-	lseek(ctx->fdout, m->outoffset, SEEK_SET);
+	out_seek(ctx, m->outoffset, SEEK_SET);
 
 	// write to fdout
-	nwrite = write(ctx->fdout, m->data, m->len);
+	nwrite = out_write(ctx, m->data, m->len);
 	if (nwrite != m->len) {
 		printf("write failed: %u != %lu %s\n", nwrite, m->len, strerror(errno));
 		exit(EXIT_FAILURE);
@@ -3154,6 +3843,17 @@ unsigned int open_best(ctx_t *ctx)
 	return ctx->shnum;
 }
 
+/**
+* Return output file name
+*/
+char *output_name(ctx_t *ctx)
+{
+	if ((ctx->opt_binname) && (strlen(ctx->opt_binname))) {
+		return ctx->opt_binname;
+	}
+	return "a.out";
+}
+
 /**
 * Open destination binary
 */
@@ -3162,19 +3862,13 @@ int open_target(ctx_t *ctx)
 	int fd = 0;
 	struct stat sb;
 	char *newname = 0;
-	char *p = 0;
 
 	if (stat(ctx->binname, &sb) == -1) {
 		perror("stat");
 		exit(EXIT_FAILURE);
 	}
 
-	if ((ctx->opt_binname) && (strlen(ctx->opt_binname))) {
-		newname = ctx->opt_binname;
-	} else {
-		newname = calloc(1, strlen(ctx->binname) + 20);
-		sprintf(newname, "a.out");
-	}
+	newname = output_name(ctx);
 
 	if (ctx->opt_debug) {
 		printf(" -- Creating output file: %s\n\n", newname);
@@ -3185,26 +3879,30 @@ int open_target(ctx_t *ctx)
 		printf(" ERROR: open(%s) %s\n", newname, strerror(errno));
 		exit(EXIT_FAILURE);
 	}
-	// set end of file
-	ftruncate(fd, sb.st_size);
+	ctx->fdout = fd;
+
+	// Output is built in memory, on top of the original binary : see out_flush()
+	ctx->out = calloc(1, sizeof(outimg_t));
+	if (!ctx->out) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	ctx->out->origsz = sb.st_size;
+	ctx->out->len = sb.st_size;
+	ctx->out->fdin = open(ctx->binname, O_RDONLY);
+	if (ctx->out->fdin < 0) {
+		printf(" ERROR: open(%s) %s\n", ctx->binname, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	out_reserve(ctx->out, sb.st_size);
 
 	// Copy default content : poison bytes or original data
-	p = calloc(1, sb.st_size);
 	if (ctx->opt_poison) {
 		// map entire binary with poison byte
-		memset(p, ctx->opt_poison, sb.st_size);
-	} else {
-		// Default : copy original binary
-		int fdin = open(ctx->binname, O_RDONLY);
-		read(fdin, p, sb.st_size);
-		close(fdin);
+		memset(ctx->out->data, ctx->opt_poison, sb.st_size);
+		memset(ctx->out->dirty, 1, ctx->out->cap >> OUT_PAGE_SHIFT);
 	}
-	lseek(fd, 0x00, SEEK_SET);
-	write(fd, p, sb.st_size);
-	free(p);
-	lseek(fd, 0x00, SEEK_SET);
 
-	ctx->fdout = fd;
 	return fd;
 }
 
@@ -3381,6 +4079,7 @@ static int read_section(ctx_t *ctx, asection *s)
 	// Add to double linked list of msec_t Meta sections
 	DL_APPEND(ctx->mshdrs, ms);
 	ctx->mshnum++;
+	free_section_index(ctx);
 
 	// Close file descriptor
 	close(fd);
@@ -3416,6 +4115,9 @@ int rd_sections(ctx_t *ctx)
 		read_section(ctx, s);
 		s = s->next;
 	}
+
+	// index sections by name, index and address
+	build_section_index(ctx);
 	return 0;
 }
 
@@ -3425,11 +4127,9 @@ int rd_sections(ctx_t *ctx)
 int save_dynstr(ctx_t *ctx, GElf_Shdr shdr, char *binary)
 {
 	if (globalstrtab == 0) {
-		globalstrtab = calloc(1, shdr.sh_size + 3);
 		globalstrtablen++;	// Start with a null byte
-	} else {
-		globalstrtab = realloc(globalstrtab, globalstrtablen + shdr.sh_size + 2);
 	}
+	gbuf_reserve(&gbuf_strtab, globalstrtablen + shdr.sh_size + 2);
 	memcpy(globalstrtab + globalstrtablen, binary + shdr.sh_offset, shdr.sh_size + 1);
 	globalstrtablen += shdr.sh_size + 1;
 
@@ -3441,16 +4141,21 @@ int save_dynstr(ctx_t *ctx, GElf_Shdr shdr, char *binary)
 */
 int save_dynsym(ctx_t *ctx, GElf_Shdr shdr, char *binary)
 {
+	Elf_Sym *s = 0;
+
 	if (globalsymtab == 0) {
-		globalsymtab = calloc(1, 2 * sizeof(Elf_Sym) + shdr.sh_size);
-		memset(globalsymtab, 0x00, sizeof(Elf_Sym));
 		globalsymtablen += sizeof(Elf_Sym);	// Skip 1 NULL entry
-	} else {
-		globalsymtab = realloc(globalsymtab, shdr.sh_size + globalsymtablen);
+		symindex_add_value(0);
 	}
+	gbuf_reserve(&gbuf_symtab, globalsymtablen + shdr.sh_size);
 
 	memcpy(globalsymtab + globalsymtablen, binary + shdr.sh_offset + sizeof(Elf_Sym), shdr.sh_size - sizeof(Elf_Sym));
 
+	// index values of the new symbols
+	for (s = (Elf_Sym *) (globalsymtab + globalsymtablen); (char *) s < globalsymtab + globalsymtablen + shdr.sh_size - sizeof(Elf_Sym); s++) {
+		symindex_add_value(s->st_value);
+	}
+
 	globalsymtablen += shdr.sh_size - sizeof(Elf_Sym);
 
 	return 0;
@@ -3514,11 +4219,7 @@ int append_reloc(Elf_Rela *r)
 	}
 
 	// save relocation
-	if (!globalreloc) {
-		globalreloc = calloc(1, sizeof(Elf_Rela));
-	} else {
-		globalreloc = realloc(globalreloc, sizeof(Elf_Rela) + globalreloclen);
-	}
+	gbuf_reserve(&gbuf_reloc, globalreloclen + sizeof(Elf_Rela));
 
 	memcpy(globalreloc + globalreloclen, r, sizeof(Elf_Rela));
 	globalreloclen += sizeof(Elf_Rela);
@@ -3546,11 +4247,7 @@ int append_data_reloc(Elf_Rela *r)
 	}
 
 	// save relocation
-	if (!globaldatareloc) {
-		globaldatareloc = calloc(1, sizeof(Elf_Rela));
-	} else {
-		globaldatareloc = realloc(globaldatareloc, sizeof(Elf_Rela) + globaldatareloclen);
-	}
+	gbuf_reserve(&gbuf_datareloc, globaldatareloclen + sizeof(Elf_Rela));
 
 	memcpy(globaldatareloc + globaldatareloclen, r, sizeof(Elf_Rela));
 	globaldatareloclen += sizeof(Elf_Rela);
@@ -3566,6 +4263,8 @@ int save_global_import(ctx_t *ctx, char *sname, msec_t *sec, Elf_Rela *r, unsign
 {
 	int rtype = 0;
 	gimport_t *g = 0;
+	gimportidx_t *gi = 0;
+	unsigned long int offset = 0;
 	Elf_Rela *rnew = 0;
 
 	rtype = ELF_R_TYPE(r->r_info);
@@ -3584,12 +4283,24 @@ int save_global_import(ctx_t *ctx, char *sname, msec_t *sec, Elf_Rela *r, unsign
 	g->r = rnew;
 	g->rtype = rtype;
 
-	if (!gimports) {
-		gimports = calloc(1, sizeof(gimport_t *));
-	} else {
-		gimports = realloc(gimports, sizeof(gimport_t *) * (gimportslen + 1));
+	gbuf_reserve(&gbuf_gimports, sizeof(gimport_t *) * (gimportslen + 1));
+	gimports[gimportslen] = g;
+
+	// index by relocation offset : the first import recorded at an offset wins
+	offset = g->r->r_offset;
+	HASH_FIND(hh, gimportsidx, &offset, sizeof(offset), gi);
+	if (!gi) {
+		gi = calloc(1, sizeof(gimportidx_t));
+		if (!gi) {
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+		gi->offset = offset;
+		gi->index = gimportslen;
+		HASH_ADD(hh, gimportsidx, offset, sizeof(offset), gi);
 	}
-	gimports[gimportslen++] = g;
+
+	gimportslen++;
 	return 0;
 }
 
@@ -3598,19 +4309,15 @@ int save_global_import(ctx_t *ctx, char *sname, msec_t *sec, Elf_Rela *r, unsign
 */
 int check_global_import(unsigned long int addr)
 {
-	unsigned int i = 0;
+	gimportidx_t *gi = 0;
 
 	if (addr < 4096) {
 		return -1;
 	}
 
-	for (i = 0; i < gimportslen; i++) {
-		if ((gimports[i]) && (gimports[i]->r) && (gimports[i]->r->r_offset == addr)) {
-			return i;
-		}
-	}
+	HASH_FIND(hh, gimportsidx, &addr, sizeof(addr), gi);
 
-	return -1;
+	return gi ? (int) gi->index : -1;
 }
 
 /**
@@ -3626,10 +4333,10 @@ int save_reloc(ctx_t *ctx, Elf_Rela *r, unsigned int sindex, int has_addend)
 	char *htype = 0;
 	msec_t *sec = 0;
 
-	Elf_Rela *rout = 0;
+	Elf_Rela rcopy;
+	Elf_Rela *rout = &rcopy;
 
-	rout = calloc(1, sizeof(Elf_Rela));	// Work on a copy of the relocation instead of the original one
-	memcpy(rout, r, sizeof(Elf_Rela));
+	memcpy(rout, r, sizeof(Elf_Rela));	// Work on a copy of the relocation instead of the original one
 
 	if (!has_addend) {
 		rout->r_addend = 0;
@@ -3694,7 +4401,7 @@ int save_reloc(ctx_t *ctx, Elf_Rela *r, unsigned int sindex, int has_addend)
 				     sname, sec->name, reloc_htype(rtype), rout->r_offset, rout->r_offset - textvma);
 			}
 			s->st_shndx = 0;
-			s->st_value = 0;	// Actual value is null in this case
+			sym_set_value(s, 0);	// Actual value is null in this case
 			return 0;
 		}
 
@@ -3740,10 +4447,10 @@ int save_data_reloc(ctx_t *ctx, Elf_Rela *r, unsigned int sindex, int has_addend
 	char *htype = 0;
 	msec_t *sec = 0;
 
-	Elf_Rela *rout = 0;
+	Elf_Rela rcopy;
+	Elf_Rela *rout = &rcopy;
 
-	rout = calloc(1, sizeof(Elf_Rela));	// Work on a copy of the relocation instead of the original one
-	memcpy(rout, r, sizeof(Elf_Rela));
+	memcpy(rout, r, sizeof(Elf_Rela));	// Work on a copy of the relocation instead of the original one
 
 	if (!has_addend) {
 		rout->r_addend = 0;
@@ -3973,7 +4680,7 @@ static int create_text_data_reloc(ctx_t *ctx, cs_insn *ins, msec_t *m, unsigned
 		Elf_Sym *st = 0;
 		st = globalsymtab + gimports[gimport]->sindex * sizeof(Elf_Sym);
 		st->st_shndx = 0;
-		st->st_value = 0;
+		sym_set_value(st, 0);
 
 		r->r_info = ELF_R_INFO(gimports[gimport]->sindex, R_X86_64_PC32);
 		r->r_addend = 0;	//-4;
@@ -4010,7 +4717,7 @@ static int create_text_data_reloc(ctx_t *ctx, cs_insn *ins, msec_t *m, unsigned
 		Elf_Sym *st = 0;
 		st = globalsymtab + gimports[gimport]->sindex * sizeof(Elf_Sym);
 		st->st_shndx = 0;
-		st->st_value = 0;
+		sym_set_value(st, 0);
 
 		r->r_info = ELF_R_INFO(gimports[gimport]->sindex, R_X86_64_PC32);
 		r->r_addend = -4;
@@ -4128,27 +4835,19 @@ static int create_text_data_reloc(ctx_t *ctx, cs_insn *ins, msec_t *m, unsigned
 */
 int internal_function_store(ctx_t *ctx, unsigned long long int addr)
 {
-	unsigned int i = 0;
 	char buff[200];
-	Elf_Sym *s = 0;
 
 	memset(buff, 0x00, 200);
 	snprintf(buff, 200, "internal_%08llx", addr);
 
 	// search this symbol in string table
-	for (i = 0; i < globalstrtablen; i += strlen(globalstrtab + i) + 1) {
-		if (str_eq(globalstrtab + i, buff)) {
-			return -1;	// already in strtab, hence in symtab
-		}
+	if (strindex_has_name(buff)) {
+		return -1;	// already in strtab, hence in symtab
 	}
 
 	// search this address in symbol table
-	for (i = 0; i < globalsymtablen / sizeof(Elf_Sym); i++) {
-		s = globalsymtab + i * sizeof(Elf_Sym);
-		//
-		if (s->st_value == addr) {
-			return -1;	// already in symtab
-		}
+	if (symindex_has_value(addr)) {
+		return -1;	// already in symtab
 	}
 
 	add_symaddr(ctx, buff, addr, 0x54);
@@ -4163,6 +4862,9 @@ static void parse_text_data_reloc(ctx_t *ctx, csh ud, cs_mode mode, cs_insn *ins
 	int i = 0;
 	cs_x86 *x86 = 0;
 	msec_t *m = 0;
+
+	wstats.insns++;
+
 	// detail can be NULL on "data" instruction if SKIPDATA option is turned ON
 	if (ins->detail == NULL)
 		return;
@@ -4233,15 +4935,20 @@ static void parse_text_data_reloc(ctx_t *ctx, csh ud, cs_mode mode, cs_insn *ins
 int analyze_data(ctx_t *ctx, msec_t *s)
 {
 	unsigned int i = 0;
-	msec_t *sec = 0, *tmp = 0;
+	msec_t *sec = 0;
 	unsigned int secindex = 0;
 	int total_relocations = 0;
+	secrange_t *ranges = 0;
+	unsigned int nranges = 0;
 
 	if (!s) {
 		printf(" -- No .data section found, skipping analysis\n");
 		return -1;
 	}
 
+	// Section boundaries (as described by section headers) sorted by address
+	ranges = build_section_ranges(ctx, 1, &nranges);
+
 	printf(" -- Analyzing .data section (Simplified)\n\n");
 	hexdump(s->data, s->len);
 	printf("\n");
@@ -4264,54 +4971,49 @@ int analyze_data(ctx_t *ctx, msec_t *s)
 			}
 
 			int found_match = 0;
-			DL_FOREACH_SAFE(ctx->mshdrs, sec, tmp) {
-				if (!sec->s_bfd || !sec->s_bfd->vma || !sec->s_elf || !sec->s_elf->sh_size) {
-					continue;
-				}
 
-				// Check if value is within section bounds
-				if (val >= sec->s_bfd->vma && val < (sec->s_bfd->vma + sec->s_elf->sh_size)) {
-					printf("  --> %s (%016lx-%016lx)", sec->name, sec->s_bfd->vma, sec->s_bfd->vma + sec->s_elf->sh_size);
+			// Check if value is within section bounds
+			sec = section_from_ranges(ranges, nranges, val);
+			if (sec) {
+				printf("  --> %s (%016lx-%016lx)", sec->name, sec->s_bfd->vma, sec->s_bfd->vma + sec->s_elf->sh_size);
 
-					// Skip self-references in .data
-					if (str_eq(sec->name, ".data")) {
-						printf(" (self-reference - skipping)");
-						goto next_entry;
-					}
+				// Skip self-references in .data
+				if (str_eq(sec->name, ".data")) {
+					printf(" (self-reference - skipping)");
+					goto next_entry;
+				}
 
-					// Create relocation
-					Elf_Rela *r = calloc(1, sizeof(Elf_Rela));
-					r->r_offset = i;
-					r->r_info = 0;
-					r->r_addend = val - sec->s_bfd->vma;
-
-					// Determine section index
-					if (str_eq(sec->name, ".text")) {
-						secindex = 1;
-					} else if (str_eq(sec->name, ".rodata")) {
-						secindex = 2;
-					} else if (str_eq(sec->name, ".data")) {
-						secindex = 3;
-					} else if (str_eq(sec->name, ".bss")) {
-						secindex = 4;
-					} else {
-						// For other sections, try to get their index
-						secindex = secindex_from_name_after_strip(ctx, sec->name);
-						if (secindex == 0) {
-							printf(" // Unknown section %s", sec->name);
-							free(r);
-							goto next_entry;
-						}
+				// Create relocation
+				Elf_Rela *r = calloc(1, sizeof(Elf_Rela));
+				r->r_offset = i;
+				r->r_info = 0;
+				r->r_addend = val - sec->s_bfd->vma;
+
+				// Determine section index
+				if (str_eq(sec->name, ".text")) {
+					secindex = 1;
+				} else if (str_eq(sec->name, ".rodata")) {
+					secindex = 2;
+				} else if (str_eq(sec->name, ".data")) {
+					secindex = 3;
+				} else if (str_eq(sec->name, ".bss")) {
+					secindex = 4;
+				} else {
+					// For other sections, try to get their index
+					secindex = secindex_from_name_after_strip(ctx, sec->name);
+					if (secindex == 0) {
+						printf(" // Unknown section %s", sec->name);
+						free(r);
+						goto next_entry;
 					}
-
-					printf(" (secindex=%d)", secindex);
-					save_data_reloc(ctx, r, secindex, 1);
-					*(unsigned long int *) (s->data + i) = 0;
-					free(r);
-					found_match = 1;
-					total_relocations++;
-					break;
 				}
+
+				printf(" (secindex=%d)", secindex);
+				save_data_reloc(ctx, r, secindex, 1);
+				*(unsigned long int *) (s->data + i) = 0;
+				free(r);
+				found_match = 1;
+				total_relocations++;
 			}
 
 next_entry:
@@ -4340,99 +5042,471 @@ next_entry:
 		}
 	}
 
+	free(ranges);
 	return 0;
 }
 
 /**
-* Parse .text section
+* A chunk of .text, disassembled by a worker thread
 */
-int analyze_text(ctx_t *ctx, char *data, unsigned int datalen, unsigned long int addr)
-{
-	csh handle;
-	cs_insn *insn = 0;
-	size_t count = 0;
-	size_t j = 0;
+typedef struct textchunk_t {
+	unsigned long int start;	// address of first instruction
+	unsigned long int end;		// chunk boundary : decoding stops at the first instruction at or after it
+	unsigned long int stop;		// address following the last decoded instruction
+	cs_insn *insn;
+	cs_detail *detail;
+	size_t count;
+	unsigned int invalid;		// decoding stopped on an invalid instruction
+	unsigned int done;
+} textchunk_t;
 
-	if (cs_open(CS_ARCH_X86, CS_MODE, &handle)) {
-		printf("error: Failed to initialize capstone library\n");
-		return -1;
-	}
+/**
+* Work shared between disassembly threads
+*/
+typedef struct textjob_t {
+	const uint8_t *data;		// .text content
+	unsigned long int addr;		// address of data[0]
+	unsigned long int len;		// number of bytes to disassemble
+	textchunk_t *chunks;
+	unsigned int nchunks;
+	unsigned int next;		// next chunk to decode
+	unsigned int merged;		// number of chunks merged so far
+	unsigned int ahead;		// maximum number of chunks decoded ahead of merging
+	unsigned int failed;		// a worker could not open capstone
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} textjob_t;
 
-	// request disassembly details
-	cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON);
+/**
+* Disassemble a .text chunk.
+* Decoding runs past chunk boundary to finish the last instruction, like a linear sweep would.
+*/
+static void decode_text_chunk(csh handle, cs_insn *ins, textjob_t *job, textchunk_t *c)
+{
+	const uint8_t *code = job->data + (c->start - job->addr);
+	size_t size = job->addr + job->len - c->start;
+	uint64_t address = c->start;
+	size_t cap = 0, j = 0;
+
+	c->count = 0;
+	while (address < c->end) {
+		if (!cs_disasm_iter(handle, &code, &size, &address, ins)) {
+			c->invalid = size ? 1 : 0;	// cs_disasm() stops on invalid instructions too
+			break;
+		}
 
-	count = cs_disasm(handle, (const uint8_t *) data, datalen - 1, addr, 0, &insn);
-	if (!count) {
-		printf("error: Cannot disassemble code\n");
-		return -1;
+		if (c->count == cap) {
+			cap = cap ? cap * 2 : 256;
+			c->insn = realloc(c->insn, cap * sizeof(cs_insn));
+			c->detail = realloc(c->detail, cap * sizeof(cs_detail));
+			if ((!c->insn) || (!c->detail)) {
+				printf(" ERROR: realloc() %s\n", strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+		}
+		memcpy(&c->insn[c->count], ins, sizeof(cs_insn));
+		memcpy(&c->detail[c->count], ins->detail, sizeof(cs_detail));
+		c->count++;
 	}
+	c->stop = address;
 
-	if (ctx->opt_asmdebug) {
-		printf(" -- parsing %lu instructions from %lx (.text) for relocations\n\n", count, addr);
-		printf("\n  Offset          Info           Type           Sym. Value    Sym. Name + Addend\n");
+	for (j = 0; j < c->count; j++) {
+		c->insn[j].detail = &c->detail[j];
 	}
+}
 
-	// scan instructions for relocations
-	for (j = 0; j < count; j++) {
+/**
+* Release decoded instructions of a .text chunk
+*/
+static void free_text_chunk(textchunk_t *c)
+{
+	free(c->insn);
+	free(c->detail);
+	c->insn = 0;
+	c->detail = 0;
+	c->count = 0;
+}
 
-		if (ctx->opt_asmdebug) {
-			printf("0x%" PRIx64 ":\t%s\t%s\n", insn[j].address, insn[j].mnemonic, insn[j].op_str);
-			print_insn_detail(ctx, handle, CS_MODE, &insn[j]);
+/**
+* Disassembly worker thread
+*/
+static void *text_worker(void *arg)
+{
+	textjob_t *job = (textjob_t *) arg;
+	textchunk_t *c = 0;
+	cs_insn *ins = 0;
+	csh handle;
+
+	if (cs_open(CS_ARCH_X86, CS_MODE, &handle)) {
+		pthread_mutex_lock(&job->lock);
+		job->failed = 1;
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock(&job->lock);
+		return NULL;
+	}
+	cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON);
+	ins = cs_malloc(handle);
+
+	pthread_mutex_lock(&job->lock);
+	while (1) {
+		// don't run too far ahead of the merging thread : bounds memory usage
+		while ((job->next < job->nchunks) && (job->next >= job->merged + job->ahead)) {
+			pthread_cond_wait(&job->cond, &job->lock);
+		}
+		if (job->next >= job->nchunks) {
+			break;
 		}
+		c = &job->chunks[job->next++];
+		pthread_mutex_unlock(&job->lock);
 
-		parse_text_data_reloc(ctx, handle, CS_MODE, &insn[j]);
+		decode_text_chunk(handle, ins, job, c);
+
+		pthread_mutex_lock(&job->lock);
+		c->done = 1;
+		pthread_cond_broadcast(&job->cond);
 	}
+	pthread_mutex_unlock(&job->lock);
 
-	cs_free(insn, count);
+	cs_free(ins, 1);
 	cs_close(&handle);
-
-	return 0;
+	return NULL;
 }
 
 /**
-* Read original symtab + strtab. BDF doesn't do this
+* Compare two addresses (qsort helper)
 */
-int rd_symtab(ctx_t *ctx)
+static int addr_cmp(const void *a, const void *b)
 {
-	Elf *elf = 0;
-	Elf_Scn *scn = NULL;
-	GElf_Shdr shdr;
-	int fd = 0;
-	const char *binary = 0;
-	struct stat sb;
-	size_t shstrndx = 0;
-	char *sname = 0;
+	unsigned long int x = *(const unsigned long int *) a;
+	unsigned long int y = *(const unsigned long int *) b;
 
-	if (ctx->opt_debug) {
-		printf(" -- searching for .strtab/.symtab\n");
-	}
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
 
-	elf_version(EV_CURRENT);
+/**
+* Split .text into chunks, cutting at known function starts when possible
+*/
+static unsigned int split_text(ctx_t *ctx, unsigned long int addr, unsigned long int len, textchunk_t **chunks)
+{
+	unsigned long int *starts = 0;
+	unsigned long int chunksz = 0, cut = 0, last = addr;
+	unsigned int nstarts = funcstartslen / sizeof(unsigned long int);
+	unsigned int n = 0, i = 0;
 
-	fd = open(ctx->binname, O_RDONLY);
-	fstat(fd, &sb);
-	binary = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-	if (binary == MAP_FAILED) {
-		perror("mmap");
-		exit(EXIT_FAILURE);
+	chunksz = len / (ctx->opt_jobs * TEXT_CHUNKS_PER_JOB);
+	if (chunksz < TEXT_CHUNK_MIN_SIZE) {
+		chunksz = TEXT_CHUNK_MIN_SIZE;
 	}
 
-	elf = elf_begin(fd, ELF_C_READ, NULL);
-	if (!elf) {
-		printf("error: not a valid ELF\n");
-		return -1;
+	*chunks = calloc(len / chunksz + nstarts + 2, sizeof(textchunk_t));
+	starts = calloc(nstarts + 1, sizeof(unsigned long int));
+	if ((!*chunks) || (!starts)) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
 	}
+	memcpy(starts, funcstarts, nstarts * sizeof(unsigned long int));
+	qsort(starts, nstarts, sizeof(unsigned long int), addr_cmp);
 
-	if (elf_getshdrstrndx(elf, &shstrndx) != 0) {
-		if (ctx->opt_verbose) {
-			printf("Warning: no .shstrtab section found\n");
+	i = 0;
+	while (last < addr + len) {
+		// first function start at least chunksz bytes away, or a fixed size cut if there is none
+		while ((i < nstarts) && (starts[i] < last + chunksz)) {
+			i++;
 		}
-		return -1;
+		cut = ((i < nstarts) && (starts[i] < addr + len)) ? starts[i] : last + chunksz;
+		if (cut > addr + len) {
+			cut = addr + len;
+		}
+		(*chunks)[n].start = last;
+		(*chunks)[n].end = cut;
+		n++;
+		last = cut;
 	}
 
-	while ((scn = elf_nextscn(elf, scn)) != NULL) {
-		gelf_getshdr(scn, &shdr);
-		sname = elf_strptr(elf, shstrndx, shdr.sh_name);
+	free(starts);
+	return n;
+}
+
+/**
+* Parse .text section using several disassembly threads.
+* Chunks are merged in address order : results are identical to analyze_text()
+*/
+int analyze_text_parallel(ctx_t *ctx, char *data, unsigned int datalen, unsigned long int addr)
+{
+	csh handle;
+	cs_insn *ins = 0;
+	textjob_t job;
+	textchunk_t inl;
+	textchunk_t *c = 0;
+	pthread_t *threads = 0;
+	unsigned long int cur = addr;
+	unsigned int i = 0, k = 0;
+	size_t j = 0, count = 0;
+
+	if (datalen < 2) {
+		printf("error: Cannot disassemble code\n");
+		return -1;
+	}
+
+	if (cs_open(CS_ARCH_X86, CS_MODE, &handle)) {
+		printf("error: Failed to initialize capstone library\n");
+		return -1;
+	}
+	cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON);
+	ins = cs_malloc(handle);
+
+	memset(&job, 0x00, sizeof(textjob_t));
+	job.data = (const uint8_t *) data;
+	job.addr = addr;
+	job.len = datalen - 1;
+	job.ahead = ctx->opt_jobs * TEXT_CHUNKS_AHEAD;
+	job.nchunks = split_text(ctx, addr, job.len, &job.chunks);
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.cond, NULL);
+
+	if (ctx->opt_asmdebug) {
+		printf(" -- parsing instructions from %lx (.text) for relocations in %u chunks, %u threads\n\n", addr, job.nchunks, ctx->opt_jobs);
+		printf("\n  Offset          Info           Type           Sym. Value    Sym. Name + Addend\n");
+	}
+
+	threads = calloc(ctx->opt_jobs, sizeof(pthread_t));
+	if (!threads) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < ctx->opt_jobs; i++) {
+		if (pthread_create(&threads[i], NULL, text_worker, &job)) {
+			printf("error: pthread_create() failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (k = 0; k < job.nchunks; k++) {
+		c = &job.chunks[k];
+
+		pthread_mutex_lock(&job.lock);
+		while ((!c->done) && (!job.failed)) {
+			pthread_cond_wait(&job.cond, &job.lock);
+		}
+		pthread_mutex_unlock(&job.lock);
+
+		if (job.failed) {
+			printf("error: Failed to initialize capstone library\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if (cur != c->start) {
+			// previous chunk ended in the middle of this one : redo it from where the sweep is
+			memset(&inl, 0x00, sizeof(textchunk_t));
+			inl.start = cur;
+			inl.end = c->end;
+			if (inl.start < inl.end) {
+				decode_text_chunk(handle, ins, &job, &inl);
+			} else {
+				inl.stop = cur;
+			}
+			free_text_chunk(c);
+			memcpy(c, &inl, sizeof(textchunk_t));
+		}
+
+		// scan instructions for relocations
+		for (j = 0; j < c->count; j++) {
+			if (ctx->opt_asmdebug) {
+				printf("0x%" PRIx64 ":\t%s\t%s\n", c->insn[j].address, c->insn[j].mnemonic, c->insn[j].op_str);
+				print_insn_detail(ctx, handle, CS_MODE, &c->insn[j]);
+			}
+
+			parse_text_data_reloc(ctx, handle, CS_MODE, &c->insn[j]);
+		}
+		count += c->count;
+		cur = c->stop;
+		free_text_chunk(c);
+
+		pthread_mutex_lock(&job.lock);
+		job.merged = k + 1;
+		if (c->invalid) {	// linear sweep ends here
+			job.next = job.nchunks;
+		}
+		pthread_cond_broadcast(&job.cond);
+		pthread_mutex_unlock(&job.lock);
+
+		if (c->invalid) {
+			break;
+		}
+	}
+
+	for (i = 0; i < ctx->opt_jobs; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	for (k = 0; k < job.nchunks; k++) {
+		free_text_chunk(&job.chunks[k]);
+	}
+
+	free(threads);
+	free(job.chunks);
+	pthread_mutex_destroy(&job.lock);
+	pthread_cond_destroy(&job.cond);
+	cs_free(ins, 1);
+	cs_close(&handle);
+
+	if (!count) {
+		printf("error: Cannot disassemble code\n");
+		return -1;
+	}
+
+	if (ctx->opt_asmdebug) {
+		printf(" -- parsed %lu instructions\n", count);
+	}
+
+	return 0;
+}
+
+/**
+* Parse .text section, one instruction at a time.
+* Memory usage doesn't depend on the size of .text
+*/
+int analyze_text_stream(ctx_t *ctx, char *data, unsigned int datalen, unsigned long int addr)
+{
+	csh handle;
+	cs_insn *ins = 0;
+	const uint8_t *code = (const uint8_t *) data;
+	size_t size = datalen - 1;
+	uint64_t address = addr;
+	size_t count = 0;
+
+	if (cs_open(CS_ARCH_X86, CS_MODE, &handle)) {
+		printf("error: Failed to initialize capstone library\n");
+		return -1;
+	}
+
+	// request disassembly details
+	cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON);
+
+	// single instruction buffer, reused for the whole section
+	ins = cs_malloc(handle);
+
+	if (ctx->opt_asmdebug) {
+		printf(" -- parsing instructions from %lx (.text) for relocations\n\n", addr);
+		printf("\n  Offset          Info           Type           Sym. Value    Sym. Name + Addend\n");
+	}
+
+	// scan instructions for relocations
+	while (cs_disasm_iter(handle, &code, &size, &address, ins)) {
+
+		if (ctx->opt_asmdebug) {
+			printf("0x%" PRIx64 ":\t%s\t%s\n", ins->address, ins->mnemonic, ins->op_str);
+			print_insn_detail(ctx, handle, CS_MODE, ins);
+		}
+
+		parse_text_data_reloc(ctx, handle, CS_MODE, ins);
+		count++;
+	}
+
+	cs_free(ins, 1);
+	cs_close(&handle);
+
+	if (!count) {
+		printf("error: Cannot disassemble code\n");
+		return -1;
+	}
+
+	if (ctx->opt_asmdebug) {
+		printf(" -- parsed %lu instructions\n", count);
+	}
+
+	return 0;
+}
+
+/**
+* Parse .text section
+*/
+int analyze_text(ctx_t *ctx, char *data, unsigned int datalen, unsigned long int addr)
+{
+	csh handle;
+	cs_insn *insn = 0;
+	size_t count = 0;
+	size_t j = 0;
+
+	if (cs_open(CS_ARCH_X86, CS_MODE, &handle)) {
+		printf("error: Failed to initialize capstone library\n");
+		return -1;
+	}
+
+	// request disassembly details
+	cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON);
+
+	count = cs_disasm(handle, (const uint8_t *) data, datalen - 1, addr, 0, &insn);
+	if (!count) {
+		printf("error: Cannot disassemble code\n");
+		return -1;
+	}
+
+	if (ctx->opt_asmdebug) {
+		printf(" -- parsing %lu instructions from %lx (.text) for relocations\n\n", count, addr);
+		printf("\n  Offset          Info           Type           Sym. Value    Sym. Name + Addend\n");
+	}
+
+	// scan instructions for relocations
+	for (j = 0; j < count; j++) {
+
+		if (ctx->opt_asmdebug) {
+			printf("0x%" PRIx64 ":\t%s\t%s\n", insn[j].address, insn[j].mnemonic, insn[j].op_str);
+			print_insn_detail(ctx, handle, CS_MODE, &insn[j]);
+		}
+
+		parse_text_data_reloc(ctx, handle, CS_MODE, &insn[j]);
+	}
+
+	cs_free(insn, count);
+	cs_close(&handle);
+
+	return 0;
+}
+
+/**
+* Read original symtab + strtab. BDF doesn't do this
+*/
+int rd_symtab(ctx_t *ctx)
+{
+	Elf *elf = 0;
+	Elf_Scn *scn = NULL;
+	GElf_Shdr shdr;
+	int fd = 0;
+	const char *binary = 0;
+	struct stat sb;
+	size_t shstrndx = 0;
+	char *sname = 0;
+
+	if (ctx->opt_debug) {
+		printf(" -- searching for .strtab/.symtab\n");
+	}
+
+	elf_version(EV_CURRENT);
+
+	fd = open(ctx->binname, O_RDONLY);
+	fstat(fd, &sb);
+	binary = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (binary == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+
+	elf = elf_begin(fd, ELF_C_READ, NULL);
+	if (!elf) {
+		printf("error: not a valid ELF\n");
+		return -1;
+	}
+
+	if (elf_getshdrstrndx(elf, &shstrndx) != 0) {
+		if (ctx->opt_verbose) {
+			printf("Warning: no .shstrtab section found\n");
+		}
+		return -1;
+	}
+
+	while ((scn = elf_nextscn(elf, scn)) != NULL) {
+		gelf_getshdr(scn, &shdr);
+		sname = elf_strptr(elf, shstrndx, shdr.sh_name);
 
 		switch (shdr.sh_type) {
 		case SHT_SYMTAB:
@@ -4496,6 +5570,7 @@ int rm_section(ctx_t *ctx, char *name)
 	}			// Not found
 
 	DL_DELETE(ctx->mshdrs, rmsec);
+	free_section_index(ctx);
 
 	ctx->shnum--;
 	ctx->mshnum--;
@@ -4516,27 +5591,254 @@ int strip_binary_reloc(ctx_t *ctx)
 
 	}
 
-	DL_FOREACH_SAFE(ctx->mshdrs, s, tmp) {
-		allowed = 0;
-		for (i = 0; i < sizeof(allowed_sections) / sizeof(char *); i++) {
-			if (str_eq(s->name, allowed_sections[i])) {
-				allowed = 1;
-				break;
-			}
-		}
-
-		if (!allowed) {
-			if (ctx->opt_verbose) {
-				printf(" * %s\n", s->name);
-			}
-
-			rm_section(ctx, s->name);
-		}
+	DL_FOREACH_SAFE(ctx->mshdrs, s, tmp) {
+		allowed = 0;
+		for (i = 0; i < sizeof(allowed_sections) / sizeof(char *); i++) {
+			if (str_eq(s->name, allowed_sections[i])) {
+				allowed = 1;
+				break;
+			}
+		}
+
+		if (!allowed) {
+			if (ctx->opt_verbose) {
+				printf(" * %s\n", s->name);
+			}
+
+			rm_section(ctx, s->name);
+		}
+	}
+
+	if (ctx->opt_verbose) {
+		printf("\n");
+	}
+	return 0;
+}
+
+/**
+* Release global tables and their indexes in one go
+*/
+int free_global_tables(ctx_t *ctx)
+{
+	struct symaddr *sa = 0, *satmp = 0;
+	symvalue_t *v = 0, *vtmp = 0;
+	symname_t *n = 0, *ntmp = 0;
+	gimportidx_t *gi = 0, *gitmp = 0;
+	unsigned int i = 0;
+
+	if (ctx->opt_verbose) {
+		printf("\n -- Global tables memory usage\n\n");
+		printf(" * total allocated:\t\t\t%lu bytes\n", gbuf_total);
+		printf(" * peak allocated:\t\t\t%lu bytes\n", gbuf_peak);
+		printf("\n");
+	}
+
+	for (i = 0; i < gimportslen; i++) {
+		free(gimports[i]->sname);
+		free(gimports[i]->r);
+		free(gimports[i]);
+	}
+	gimportslen = 0;
+
+	HASH_ITER(hh, gimportsidx, gi, gitmp) {
+		HASH_DEL(gimportsidx, gi);
+		free(gi);
+	}
+
+	gbuf_free(&gbuf_symtab);
+	gbuf_free(&gbuf_strtab);
+	gbuf_free(&gbuf_reloc);
+	gbuf_free(&gbuf_datareloc);
+	gbuf_free(&gbuf_gimports);
+	gbuf_free(&gbuf_rela_data_rel_ro_local);
+	gbuf_free(&gbuf_funcstarts);
+	globalsymtablen = 0;
+	globalstrtablen = 0;
+	globalreloclen = 0;
+	globaldatareloclen = 0;
+	rela_data_rel_ro_local_len = 0;
+	funcstartslen = 0;
+
+	HASH_ITER(hh, symvalues, v, vtmp) {
+		HASH_DEL(symvalues, v);
+		free(v);
+	}
+
+	HASH_ITER(hh, symnames, n, ntmp) {
+		HASH_DEL(symnames, n);
+		free(n->name);
+		free(n);
+	}
+	symnamesoffset = 0;
+
+	LL_FOREACH_SAFE(symaddrs, sa, satmp) {
+		LL_DELETE(symaddrs, sa);
+		free(sa->name);
+		free(sa);
+	}
+
+	return 0;
+}
+
+/**
+* Return current resident set size, in KB
+*/
+static long current_rss(void)
+{
+	long pages = 0, resident = 0;
+	FILE *f = 0;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f) {
+		return 0;
+	}
+	if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+		resident = 0;
+	}
+	fclose(f);
+
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/**
+* Return t1 - t0 in seconds
+*/
+static double elapsed(struct timespec *t0, struct timespec *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/**
+* End current --stats phase and start a new one (none if name is NULL)
+*/
+void stats_phase(ctx_t *ctx, const char *name)
+{
+	struct timespec wall, cpu;
+
+	if (!ctx->opt_stats) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+
+	if (wstats.cur) {
+		wstats.cur->wall += elapsed(&wstats.wall0, &wall);
+		wstats.cur->cpu += elapsed(&wstats.cpu0, &cpu);
+		wstats.cur->rss += current_rss() - wstats.rss0;
+		wstats.cur = 0;
+	}
+
+	if ((!name) || (wstats.nphases == STATS_MAX_PHASES)) {
+		return;
+	}
+
+	wstats.cur = &wstats.phases[wstats.nphases++];
+	wstats.cur->name = name;
+	wstats.wall0 = wall;
+	wstats.cpu0 = cpu;
+	wstats.rss0 = current_rss();
+}
+
+/**
+* Print a string as a JSON string literal
+*/
+static void json_string(FILE *f, const char *str)
+{
+	const unsigned char *p = (const unsigned char *) str;
+
+	fputc('"', f);
+	for (; (p) && (*p); p++) {
+		if ((*p == '"') || (*p == '\\')) {
+			fprintf(f, "\\%c", *p);
+		} else if (*p < 0x20) {
+			fprintf(f, "\\u%04x", *p);
+		} else {
+			fputc(*p, f);
+		}
+	}
+	fputc('"', f);
+}
+
+/**
+* Print --stats report on stderr, as a table or as json
+*/
+int stats_report(ctx_t *ctx)
+{
+	phase_t total;
+	unsigned int i = 0;
+
+	if (!ctx->opt_stats) {
+		return 0;
+	}
+
+	stats_phase(ctx, NULL);
+
+	wstats.relocs = (globalreloclen + globaldatareloclen + rela_data_rel_ro_local_len) / sizeof(Elf_Rela);
+	wstats.syms = globalsymtablen ? globalsymtablen / sizeof(Elf_Sym) - 1 : 0;	// minus NULL entry
+
+	memset(&total, 0x00, sizeof(phase_t));
+	for (i = 0; i < wstats.nphases; i++) {
+		total.wall += wstats.phases[i].wall;
+		total.cpu += wstats.phases[i].cpu;
+		total.rss += wstats.phases[i].rss;
+	}
+
+	if (ctx->opt_stats == 2) {
+		fprintf(stderr, "{\"binary\": ");
+		json_string(stderr, ctx->binname);
+		fprintf(stderr, ", \"phases\": [");
+		for (i = 0; i < wstats.nphases; i++) {
+			fprintf(stderr, "%s{\"name\": ", i ? ", " : "");
+			json_string(stderr, wstats.phases[i].name);
+			fprintf(stderr, ", \"wall\": %.6f, \"cpu\": %.6f, \"rss_kb\": %ld}", wstats.phases[i].wall, wstats.phases[i].cpu, wstats.phases[i].rss);
+		}
+		fprintf(stderr, "], \"wall\": %.6f, \"cpu\": %.6f, \"instructions\": %lu, \"relocations\": %lu, \"symbols\": %lu, \"bytes_written\": %lu, \"cached\": %s}\n",
+			total.wall, total.cpu, wstats.insns, wstats.relocs, wstats.syms, wstats.written, wstats.cached ? "true" : "false");
+		return 0;
+	}
+
+	fprintf(stderr, "\n -- Statistics for %s\n\n", ctx->binname);
+	fprintf(stderr, " %-24s %12s %12s %12s\n", "phase", "wall (s)", "cpu (s)", "rss (KB)");
+	fprintf(stderr, "---------------------------------------------------------------------\n");
+	for (i = 0; i < wstats.nphases; i++) {
+		fprintf(stderr, " %-24s %12.6f %12.6f %+12ld\n", wstats.phases[i].name, wstats.phases[i].wall, wstats.phases[i].cpu, wstats.phases[i].rss);
+	}
+	fprintf(stderr, "---------------------------------------------------------------------\n");
+	fprintf(stderr, " %-24s %12.6f %12.6f %+12ld\n\n", "total", total.wall, total.cpu, total.rss);
+	fprintf(stderr, " * instructions decoded:\t\t%lu\n", wstats.insns);
+	fprintf(stderr, " * relocations created:\t\t%lu\n", wstats.relocs);
+	fprintf(stderr, " * symbols:\t\t\t\t%lu\n", wstats.syms);
+	fprintf(stderr, " * bytes written:\t\t\t%lu\n", wstats.written);
+	if (wstats.cached) {
+		fprintf(stderr, " * output fetched from cache\n");
+	}
+
+	return 0;
+}
+
+/**
+* Report peak resident set size, and check it against --max-rss
+*/
+int report_rss(ctx_t *ctx)
+{
+	struct rusage ru;
+
+	memset(&ru, 0x00, sizeof(struct rusage));
+	if (getrusage(RUSAGE_SELF, &ru)) {
+		printf(" !! WARNING: getrusage() %s\n", strerror(errno));
+		return -1;
+	}
+
+	if ((ctx->opt_verbose) || (ctx->opt_max_rss)) {
+		printf(" -- Peak RSS:\t\t\t\t%lu KB\n", (unsigned long int) ru.ru_maxrss);
 	}
 
-	if (ctx->opt_verbose) {
-		printf("\n");
+	if ((ctx->opt_max_rss) && ((unsigned long int) ru.ru_maxrss > ctx->opt_max_rss)) {
+		fprintf(stderr, " !! WARNING: peak RSS %lu KB exceeds --max-rss %lu KB\n", (unsigned long int) ru.ru_maxrss, ctx->opt_max_rss);
+		return -1;
 	}
+
 	return 0;
 }
 
@@ -4557,11 +5859,13 @@ unsigned int libify(ctx_t *ctx)
 	/**
 	* Load each section of binary using bfd
 	*/
+	stats_phase(ctx, "load_binary");
 	load_binary(ctx);
 
 	/**
 	* Print BFD sections
 	*/
+	stats_phase(ctx, "rd_extended");
 	print_bfd_sections(ctx);
 
 	/**
@@ -4575,11 +5879,13 @@ unsigned int libify(ctx_t *ctx)
 	/**
 	* Open target binary
 	*/
+	stats_phase(ctx, "open_target");
 	open_target(ctx);
 
 	/**
 	* Read sections from disk
 	*/
+	stats_phase(ctx, "rd_sections");
 	rd_sections(ctx);
 
 	create_section_symbols(ctx);
@@ -4587,6 +5893,7 @@ unsigned int libify(ctx_t *ctx)
 	/**
 	* Read symtab + strtab : BFD doesn't do this
 	*/
+	stats_phase(ctx, "rd_symtab");
 	rd_symtab(ctx);
 
 	fixup_strtab_and_symtab(ctx);
@@ -4594,6 +5901,7 @@ unsigned int libify(ctx_t *ctx)
 	/**
 	* Read symbols
 	*/
+	stats_phase(ctx, "rd_symbols");
 	target = bfd_get_target(ctx->abfd);
 
 	is_pe64 = (strcmp(target, "pe-x86-64") == 0 || strcmp(target, "pei-x86-64") == 0);
@@ -4628,6 +5936,7 @@ unsigned int libify(ctx_t *ctx)
 	/**
 	* Parse relocations
 	*/
+	stats_phase(ctx, "parse_relocations");
 	parse_relocations(ctx);
 
 	/**
@@ -4641,8 +5950,10 @@ unsigned int libify(ctx_t *ctx)
 	*
 	*/
 
+	stats_phase(ctx, "analyze_text");
 	process_text(ctx);
 
+	stats_phase(ctx, "analyze_data");
 	process_data(ctx);
 
 	if (!ctx->opt_no_data_relro) {
@@ -4652,11 +5963,13 @@ unsigned int libify(ctx_t *ctx)
 	/**
 	* Copy each section content in output file
 	*/
+	stats_phase(ctx, "copy_body");
 	copy_body(ctx);
 
 	/**
 	* Relocation stripping
 	*/
+	stats_phase(ctx, "mk_phdrs");
 	if ((ctx->opt_static) || (ctx->opt_reloc)) {
 		rm_section(ctx, ".interp");
 		rm_section(ctx, ".dynamic");
@@ -4690,11 +6003,13 @@ unsigned int libify(ctx_t *ctx)
 	/**
 	* Write strtab and symtab
 	*/
+	stats_phase(ctx, "write_strtab_and_reloc");
 	write_strtab_and_reloc(ctx);
 
 	/**
 	* Add section headers to output file
 	*/
+	stats_phase(ctx, "write_shdrs");
 	if (!ctx->opt_sstrip) {
 		write_shdrs(ctx);
 	}
@@ -4702,6 +6017,7 @@ unsigned int libify(ctx_t *ctx)
 	/**
 	* Add segment headers to output file
 	*/
+	stats_phase(ctx, "write_phdrs");
 	if (!ctx->opt_reloc) {
 		if (!ctx->opt_original) {
 			write_phdrs(ctx);
@@ -4714,15 +6030,486 @@ unsigned int libify(ctx_t *ctx)
 	/**
 	* Add ELF Header to output file
 	*/
+	stats_phase(ctx, "mk_ehdr");
 	mk_ehdr(ctx);
 
+	/**
+	* Write output file to disk
+	*/
+	stats_phase(ctx, "out_flush");
+	out_flush(ctx);
+	close(ctx->fdout);
+
+	stats_report(ctx);
+
 	/**
 	* Finalize/Close/Cleanup
 	*/
+	free_global_tables(ctx);
+
+	report_rss(ctx);
+
+	return 0;
+}
+
+/**
+* Compute output cache key : SHA-1 of input binary and of every option changing the output
+*/
+int cache_key(ctx_t *ctx, char *key)
+{
+	struct sha1_ctx sha;
+	unsigned char digest[SHA1_DIGEST_SIZE];
+	unsigned char buf[65536];
+	char opts[1024];
+	unsigned int i = 0;
+	ssize_t n = 0;
+	int fd = 0;
+
+	fd = open(ctx->binname, O_RDONLY);
+	if (fd < 0) {
+		printf(" !! WARNING: open(%s) %s\n", ctx->binname, strerror(errno));
+		return -1;
+	}
+
+	sha1_init_ctx(&sha);
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		sha1_process_bytes(buf, n, &sha);
+	}
+	close(fd);
+	if (n < 0) {
+		printf(" !! WARNING: read(%s) %s\n", ctx->binname, strerror(errno));
+		return -1;
+	}
+
+	snprintf(opts, sizeof(opts), "%s|%u|%u|%u|%u|%u|%u|%u|%u|%lx|%s|%u|%u|%u|%u|%u|%x",
+		 WVERSION, ctx->opt_arch, ctx->opt_static, ctx->opt_reloc, ctx->opt_strip, ctx->opt_sstrip,
+		 ctx->opt_exec, ctx->opt_core, ctx->opt_shared, ctx->opt_entrypoint,
+		 ctx->opt_interp ? ctx->opt_interp : "", ctx->opt_poison, ctx->opt_no_data_relro,
+		 ctx->opt_no_extra_symbols, ctx->opt_original, ctx->opt_keep_main, ctx->opt_flags);
+	sha1_process_bytes(opts, strlen(opts), &sha);
+	sha1_finish_ctx(&sha, digest);
+
+	for (i = 0; i < SHA1_DIGEST_SIZE; i++) {
+		sprintf(key + 2 * i, "%02x", digest[i]);
+	}
+	return 0;
+}
+
+/**
+* Copy a file, trying a reflink first
+*/
+int copy_file(const char *src, const char *dst)
+{
+	char buf[65536];
+	ssize_t n = 0;
+	int fdin = 0, fdout = 0, ret = 0;
+
+	fdin = open(src, O_RDONLY);
+	if (fdin < 0) {
+		return -1;
+	}
+	fdout = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fdout < 0) {
+		close(fdin);
+		return -1;
+	}
+
+#ifdef FICLONE
+	if (ioctl(fdout, FICLONE, fdin) == 0) {	// copy on write clone
+		close(fdin);
+		close(fdout);
+		return 0;
+	}
+#endif
+
+	while ((n = read(fdin, buf, sizeof(buf))) > 0) {
+		if (write(fdout, buf, n) != n) {
+			ret = -1;
+			break;
+		}
+	}
+	if (n < 0) {
+		ret = -1;
+	}
+
+	close(fdin);
+	close(fdout);
+	return ret;
+}
+
+/**
+* Materialize a cached output : reflink, else copy.
+* Never a hard link : rewriting the output in place would alter the cache entry.
+*/
+int cache_fetch(ctx_t *ctx, const char *path, const char *outname)
+{
+	char *tmp = 0;
+	int ret = -1;
+
+	tmp = calloc(1, strlen(outname) + 32);
+	sprintf(tmp, "%s.wcc%u", outname, getpid());
+
+	ret = copy_file(path, tmp);
+	if ((ret == 0) && (rename(tmp, outname))) {
+		ret = -1;
+	}
+	if (ret) {
+		unlink(tmp);
+	}
+
+	free(tmp);
+	return ret;
+}
+
+/**
+* Save an output in the cache
+*/
+int cache_store(ctx_t *ctx, const char *path, const char *outname)
+{
+	char *tmp = 0;
+	int ret = 0;
+
+	tmp = calloc(1, strlen(path) + 32);
+	sprintf(tmp, "%s.tmp%u", path, getpid());
+
+	// independent copy (or reflink) : later changes to the output don't alter the cache
+	ret = copy_file(outname, tmp);
+	if ((ret == 0) && (rename(tmp, path))) {
+		ret = -1;
+	}
+	if (ret) {
+		printf(" !! WARNING: could not save %s in cache : %s\n", outname, strerror(errno));
+		unlink(tmp);
+	}
+
+	free(tmp);
+	return ret;
+}
+
+/**
+* Cache entry, used when evicting
+*/
+typedef struct centry_t {
+	char *path;
+	off_t size;
+	time_t mtime;	// last use
+} centry_t;
+
+/**
+* Compare cache entries by last use (qsort helper)
+*/
+static int centry_cmp(const void *a, const void *b)
+{
+	const centry_t *x = (const centry_t *) a;
+	const centry_t *y = (const centry_t *) b;
+
+	return x->mtime < y->mtime ? -1 : (x->mtime > y->mtime ? 1 : 0);
+}
+
+/**
+* Remove least recently used cache entries until the cache fits in opt_cache_size
+*/
+int cache_evict(ctx_t *ctx)
+{
+	DIR *d = 0;
+	struct dirent *de = 0;
+	struct stat sb;
+	centry_t *entries = 0;
+	unsigned int n = 0, cap = 0, i = 0;
+	unsigned long int total = 0;
+	char *path = 0;
+
+	if (!ctx->opt_cache_size) {
+		return 0;
+	}
+
+	d = opendir(ctx->opt_cache);
+	if (!d) {
+		return -1;
+	}
+
+	while ((de = readdir(d)) != NULL) {
+		if (strlen(de->d_name) != 2 * SHA1_DIGEST_SIZE) {
+			continue;	// not a cache entry
+		}
+		path = calloc(1, strlen(ctx->opt_cache) + strlen(de->d_name) + 2);
+		sprintf(path, "%s/%s", ctx->opt_cache, de->d_name);
+		if ((stat(path, &sb)) || (!S_ISREG(sb.st_mode))) {
+			free(path);
+			continue;
+		}
+		if (n == cap) {
+			cap = cap ? cap * 2 : 64;
+			entries = realloc(entries, cap * sizeof(centry_t));
+			if (!entries) {
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+		entries[n].path = path;
+		entries[n].size = sb.st_size;
+		entries[n].mtime = sb.st_mtime;
+		total += sb.st_size;
+		n++;
+	}
+	closedir(d);
+
+	qsort(entries, n, sizeof(centry_t), centry_cmp);
+	for (i = 0; (i < n) && (total > ctx->opt_cache_size); i++) {
+		if (ctx->opt_verbose) {
+			printf(" * evicting %s from cache\n", entries[i].path);
+		}
+		if (unlink(entries[i].path) == 0) {
+			total -= entries[i].size;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		free(entries[i].path);
+	}
+	free(entries);
+	return 0;
+}
+
+/**
+* Libify a binary, reusing a previous output from the cache if possible
+*/
+unsigned int libify_cached(ctx_t *ctx)
+{
+	char key[2 * SHA1_DIGEST_SIZE + 1];
+	char *path = 0, *outname = 0;
+
+	if (!ctx->opt_cache) {
+		return libify(ctx);
+	}
+
+	if ((mkdir(ctx->opt_cache, 0755)) && (errno != EEXIST)) {
+		printf(" !! WARNING: mkdir(%s) %s, not using cache\n", ctx->opt_cache, strerror(errno));
+		return libify(ctx);
+	}
+
+	stats_phase(ctx, "cache_lookup");
+	memset(key, 0x00, sizeof(key));
+	if (cache_key(ctx, key)) {
+		return libify(ctx);
+	}
 
+	outname = output_name(ctx);
+	path = calloc(1, strlen(ctx->opt_cache) + sizeof(key) + 2);
+	sprintf(path, "%s/%s", ctx->opt_cache, key);
+
+	if ((access(path, R_OK) == 0) && (cache_fetch(ctx, path, outname) == 0)) {
+		printf(" -- cache hit: %s (%s)\n", outname, key);
+		utimensat(AT_FDCWD, path, NULL, 0);	// mark as recently used
+		free(path);
+		wstats.cached = 1;
+		stats_report(ctx);
+		report_rss(ctx);
+		return 0;
+	}
+
+	if (ctx->opt_verbose) {
+		printf(" -- cache miss: %s (%s)\n", outname, key);
+	}
+
+	libify(ctx);
+
+	cache_store(ctx, path, outname);
+	cache_evict(ctx);
+
+	free(path);
 	return 0;
 }
 
+/**
+* Read the list of binaries to process in batch mode.
+* One binary per line, optionally followed by an output file name.
+* Default output names are made unique (foo.out, foo-2.out...), explicit duplicates are rejected.
+*/
+batch_t *rd_batch_list(ctx_t *ctx)
+{
+	FILE *f = 0;
+	char line[PATH_MAX * 2 + 2];
+	char *input = 0, *output = 0, *p = 0;
+	char *outdir = 0, *ext = 0;
+	batch_t *list = 0, *b = 0, *dup = 0, *outputs = 0;
+	unsigned int n = 0;
+
+	f = str_eq(ctx->opt_batch, "-") ? stdin : fopen(ctx->opt_batch, "r");
+	if (!f) {
+		printf("error: fopen(%s) : %s\n", ctx->opt_batch, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	// In batch mode, -o is the output directory
+	outdir = ((ctx->opt_binname) && (strlen(ctx->opt_binname))) ? ctx->opt_binname : ".";
+	ext = ctx->opt_reloc ? ".o" : (ctx->opt_shared ? ".so" : ".out");
+
+	while (fgets(line, sizeof(line), f)) {
+		input = strtok(line, " \t\r\n");
+		if ((!input) || (*input == '#')) {
+			continue;	// empty line or comment
+		}
+		output = strtok(NULL, " \t\r\n");
+
+		b = calloc(1, sizeof(batch_t));
+		if (!b) {
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+		b->input = strdup(input);
+		if (output) {
+			b->output = strdup(output);
+			HASH_FIND_STR(outputs, b->output, dup);
+			if (dup) {
+				printf("error: %s and %s both write to %s\n", dup->input, b->input, b->output);
+				exit(EXIT_FAILURE);
+			}
+		} else {
+			p = strrchr(input, '/');
+			p = p ? p + 1 : input;
+			b->output = calloc(1, strlen(outdir) + strlen(p) + strlen(ext) + 16);
+			sprintf(b->output, "%s/%s%s", outdir, p, ext);
+			HASH_FIND_STR(outputs, b->output, dup);
+			for (n = 2; dup; n++) {
+				sprintf(b->output, "%s/%s-%u%s", outdir, p, n, ext);
+				HASH_FIND_STR(outputs, b->output, dup);
+			}
+		}
+		HASH_ADD_KEYPTR(hh, outputs, b->output, strlen(b->output), b);
+		DL_APPEND(list, b);
+	}
+
+	if (f != stdin) {
+		fclose(f);
+	}
+	HASH_CLEAR(hh, outputs);
+	return list;
+}
+
+/**
+* Process one batch target : runs in a worker process
+*/
+static int batch_worker(ctx_t *ctx, batch_t *b)
+{
+	struct stat sb;
+	int fd = 0;
+
+	// Each target gets its own context, initialized from command line options
+	ctx->binname = b->input;
+	ctx->opt_binname = b->output;
+	ctx->opt_batch = 0;
+	ctx->opt_jobs = 0;
+	ctx->strndx = calloc(1, DEFAULT_STRNDX_SIZE);
+	ctx->mshdrs = NULL;
+
+	if (stat(b->input, &sb)) {
+		fprintf(stderr, "error: Could not open file %s : %s\n", b->input, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	orig_sz = sb.st_size;
+
+	// Keep stdout for verbose runs only : workers run concurrently
+	if (!ctx->opt_verbose) {
+		fd = open("/dev/null", O_WRONLY);
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			close(fd);
+		}
+	}
+
+	libify_cached(ctx);
+	fflush(stdout);
+	exit(EXIT_SUCCESS);
+}
+
+/**
+* Process many binaries, up to opt_jobs at a time, each in its own worker process.
+* Libraries are initialized once, before forking.
+*/
+int libify_batch(ctx_t *ctx)
+{
+	batch_t *list = 0, *b = 0, *next = 0;
+	struct timespec end;
+	unsigned int jobs = ctx->opt_jobs ? ctx->opt_jobs : 1;
+	unsigned int running = 0, total = 0, failed = 0;
+	double elapsed = 0;
+	int status = 0;
+	pid_t pid = 0;
+
+	list = rd_batch_list(ctx);
+	next = list;
+
+	fflush(stdout);
+	while ((next) || (running)) {
+		// start workers
+		while ((next) && (running < jobs)) {
+			clock_gettime(CLOCK_MONOTONIC, &next->start);
+			next->pid = fork();
+			if (next->pid < 0) {
+				printf("error: fork() : %s\n", strerror(errno));
+				exit(EXIT_FAILURE);
+			} else if (next->pid == 0) {
+				batch_worker(ctx, next);
+			}
+			running++;
+			next = next->next;
+		}
+
+		// wait for one of them
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			printf("error: waitpid() : %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		DL_FOREACH(list, b) {
+			if (b->pid == pid) {
+				b->status = status;
+				b->elapsed = (end.tv_sec - b->start.tv_sec) + (end.tv_nsec - b->start.tv_nsec) / 1e9;
+				running--;
+				break;
+			}
+		}
+	}
+
+	/**
+	* Summary
+	*/
+	printf("\n -- Batch summary\n\n");
+	printf(" status\t\t  time (s)\tinput\t\t\t\toutput\n");
+	printf(" --------------------------------------------------------------------------------\n");
+
+	DL_FOREACH(list, b) {
+		char hstatus[32];
+
+		if ((WIFEXITED(b->status)) && (WEXITSTATUS(b->status) == 0)) {
+			snprintf(hstatus, sizeof(hstatus), "ok");
+		} else if (WIFEXITED(b->status)) {
+			snprintf(hstatus, sizeof(hstatus), "exit %d", WEXITSTATUS(b->status));
+			failed++;
+		} else {
+			snprintf(hstatus, sizeof(hstatus), "signal %d", WTERMSIG(b->status));
+			failed++;
+		}
+		printf(" %-10s\t%10.3f\t%-30s\t%s\n", hstatus, b->elapsed, b->input, b->output);
+		elapsed += b->elapsed;
+		total++;
+	}
+
+	printf("\n -- %u files, %u ok, %u failed, %.3f s of work on %u workers\n\n", total, total - failed, failed, elapsed, jobs);
+
+	DL_FOREACH_SAFE(list, b, next) {
+		DL_DELETE(list, b);
+		free(b->input);
+		free(b->output);
+		free(b);
+	}
+
+	return failed ? -1 : 0;
+}
+
 /**
 * Print content of /proc/pid/maps
 */
@@ -4771,6 +6558,13 @@ int usage(char *name)
 	printf("    -e, --entrypoint       <0xaddress>\n");
 	printf("    -i, --interpreter      <interpreter>\n");
 	printf("    -p, --poison           <poison>\n");
+	printf("    -j, --jobs             <threads>\n");
+	printf("    -b, --batch            <list file>\n");
+	printf("    -K, --cache            <cache directory>\n");
+	printf("    -Z, --cache-size       <megabytes>\n");
+	printf("    -M, --max-rss          <megabytes>\n");
+	printf("    -t, --stream\n");
+	printf("    -T, --stats[=json]\n");
 	printf("    -s, --shared\n");
 	printf("    -c, --compile\n");
 	printf("    -S, --static\n");
@@ -4827,8 +6621,10 @@ int desired_arch(ctx_t *ctx, char *name)
 */
 int ctx_getopt(ctx_t *ctx, int argc, char **argv)
 {
-	const char *short_opt = "ho:i:scSEsxCvVXp:Odm:e:f:DknN";
+	const char *short_opt = "ho:i:scSEsxCvVXp:Odm:e:f:DknNj:M:tb:K:Z:T::";
 	int count = 0;
+	unsigned long jobs = 0;
+	char *endptr = NULL;
 	struct stat sb;
 	int c = 0;
 
@@ -4848,6 +6644,13 @@ int ctx_getopt(ctx_t *ctx, int argc, char **argv)
 		{ "entrypoint", required_argument, NULL, 'e' },
 		{ "interpreter", required_argument, NULL, 'i' },
 		{ "poison", required_argument, NULL, 'p' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ "batch", required_argument, NULL, 'b' },
+		{ "cache", required_argument, NULL, 'K' },
+		{ "cache-size", required_argument, NULL, 'Z' },
+		{ "max-rss", required_argument, NULL, 'M' },
+		{ "stream", no_argument, NULL, 't' },
+		{ "stats", optional_argument, NULL, 'T' },
 		{ "original", no_argument, NULL, 'O' },
 		{ "keep-main", no_argument, NULL, 'k' },
 		{ "no-data-rel-ro", no_argument, NULL, 'n' },
@@ -4872,6 +6675,11 @@ int ctx_getopt(ctx_t *ctx, int argc, char **argv)
 		case 0:
 			break;
 
+		case 'b':
+			ctx->opt_batch = strdup(optarg);
+			count++;
+			break;
+
 		case 'c':
 			ctx->opt_reloc = 1;
 			break;
@@ -4913,15 +6721,41 @@ int ctx_getopt(ctx_t *ctx, int argc, char **argv)
 			count++;
 			break;
 
+		case 'j':
+			jobs = strtoul(optarg, &endptr, 10);
+			if ((!isdigit((unsigned char) optarg[0])) || (*endptr) || (!jobs)) {
+				fprintf(stderr, "error: -j/--jobs expects a number of threads, got '%s'.\n", optarg);
+				fprintf(stderr, "Try `%s --help' for more information.\n", argv[0]);
+				exit(-2);
+			}
+			if (jobs > MAX_JOBS) {
+				fprintf(stderr, "warning: -j/--jobs %s capped to %u.\n", optarg, MAX_JOBS);
+				jobs = MAX_JOBS;
+			}
+			ctx->opt_jobs = jobs;
+			count++;
+			break;
+
 		case 'k':
 			ctx->opt_keep_main = 1;
 			break;
 
+		case 'K':
+			ctx->opt_cache = strdup(optarg);
+			count++;
+			break;
+
 		case 'm':
 			ctx->opt_arch = desired_arch(ctx, optarg);
 			count++;
 			break;
 
+		case 'M':
+			ctx->opt_max_rss = strtoul(optarg, NULL, 10) * 1024;
+			ctx->opt_stream = 1;
+			count++;
+			break;
+
 		case 'n':
 			ctx->opt_no_data_relro = 1;
 			break;
@@ -4952,6 +6786,20 @@ int ctx_getopt(ctx_t *ctx, int argc, char **argv)
 			ctx->opt_static = 1;
 			break;
 
+		case 't':
+			ctx->opt_stream = 1;
+			break;
+
+		case 'T':
+			ctx->opt_stats = 1;
+			if ((optarg) && (str_eq(optarg, "json"))) {
+				ctx->opt_stats = 2;
+			} else if (optarg) {
+				printf("error: unknown stats format: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+
 		case 'v':
 			ctx->opt_verbose = 1;
 			break;
@@ -4969,6 +6817,11 @@ int ctx_getopt(ctx_t *ctx, int argc, char **argv)
 			ctx->opt_sstrip = 1;
 			break;
 
+		case 'Z':
+			ctx->opt_cache_size = strtoul(optarg, NULL, 10) * 1024 * 1024;
+			count++;
+			break;
+
 		case ':':
 		case '?':
 			fprintf(stderr, "Try `%s --help' for more information.\n", argv[0]);
@@ -4981,6 +6834,18 @@ int ctx_getopt(ctx_t *ctx, int argc, char **argv)
 		};
 	};
 
+	// in batch mode, binaries are listed in a file
+	if (ctx->opt_batch) {
+		return 0;
+	}
+
+	// threaded and streaming disassembly are exclusive : refuse rather than silently pick one
+	if ((ctx->opt_jobs > 1) && (ctx->opt_stream)) {
+		fprintf(stderr, "error: -j/--jobs can't be combined with -t/--stream or -M/--max-rss.\n");
+		fprintf(stderr, "Try `%s --help' for more information.\n", argv[0]);
+		exit(-2);
+	}
+
 	// arguments sanity checks
 	if (count >= argc - 1) {
 		fprintf(stderr, "error: No source binary found in arguments.\n");
@@ -5012,7 +6877,12 @@ int main(int argc, char **argv)
 
 	ctx = ctx_init();
 	ctx_getopt(ctx, argc, argv);
-	libify(ctx);
+
+	if (ctx->opt_batch) {
+		return libify_batch(ctx) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	libify_cached(ctx);
 
 	return 0;
 }
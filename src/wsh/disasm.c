@@ -39,6 +39,7 @@
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
+#include <utlist.h>
 
 #include <libwitch/wsh.h>
 #include <libwitch/disasm.h>
@@ -120,6 +121,175 @@ static arch_info_t supported_archs[] = {
 static arch_info_t *default_arch = NULL;
 static binary_arch_t *binary_archs = NULL;
 
+// Address -> architecture index, over the PT_LOAD segments of registered binaries
+static addrindex_t arch_index;
+static unsigned long arch_index_gen = 0;
+
+// Capstone handles, one per supported_archs[] entry
+static arch_handle_t arch_handles[sizeof(supported_archs) / sizeof(arch_info_t)];
+
+// Decoded instruction cache
+static dcache_entry_t *dcache = NULL;		// uthash.h, keyed by dcache_key_t
+static dcache_entry_t *dcache_lru = NULL;	// utlist.h, least recently used first
+static unsigned long dcache_insns = 0;
+static unsigned long dcache_lo = 0, dcache_hi = 0;	// Address span of cached entries
+
+/**
+ * Return the session capstone handle of an architecture, opening it on first use
+ */
+int disasm_handle(arch_info_t *arch, int detail, csh *handle)
+{
+	arch_handle_t *h = NULL;
+
+	if ((arch < supported_archs) || (arch >= supported_archs + sizeof(supported_archs) / sizeof(arch_info_t))) {
+		return -1;
+	}
+	h = &arch_handles[arch - supported_archs];
+
+	if (!h->opened) {
+		if (cs_open(arch->arch, arch->mode, &h->handle)) {
+			return -1;
+		}
+		h->opened = 1;
+		h->detail = 0;
+	}
+
+	if (h->detail != detail) {
+		cs_option(h->handle, CS_OPT_DETAIL, detail ? CS_OPT_ON : CS_OPT_OFF);
+		h->detail = detail;
+	}
+
+	*handle = h->handle;
+	return 0;
+}
+
+/**
+ * Release a decode cache entry
+ */
+static void dcache_drop(dcache_entry_t *e)
+{
+	HASH_DEL(dcache, e);
+	DL_DELETE(dcache_lru, e);
+	dcache_insns -= e->count;
+	free(e->insns);
+	free(e->strs);
+	free(e->bytes);
+	free(e);
+}
+
+/**
+ * Drop cached decodings overlapping [addr, addr+len).
+ * Only needed when memory may have been unmapped: modified code is detected on lookup.
+ */
+void disasm_invalidate(unsigned long addr, unsigned long len)
+{
+	dcache_entry_t *e = NULL, *tmp = NULL;
+	unsigned long end = (addr + len < addr) ? (unsigned long) -1 : addr + len;
+
+	if ((!dcache) || (end <= dcache_lo) || (addr >= dcache_hi)) {
+		return;
+	}
+
+	HASH_ITER(hh, dcache, e, tmp) {
+		if ((addr < e->key.addr + e->key.length) && (end > e->key.addr)) {
+			dcache_drop(e);
+		}
+	}
+
+	if (!dcache) {
+		dcache_lo = dcache_hi = 0;
+	}
+}
+
+/**
+ * Decode length bytes at addr, through the decode cache.
+ * Returns NULL if nothing could be decoded.
+ */
+static dcache_entry_t *dcache_decode(arch_info_t *arch, unsigned long addr, unsigned int length)
+{
+	dcache_entry_t *e = NULL;
+	dcache_key_t key;
+	csh handle;
+	cs_insn *insn = NULL;
+	uint8_t *bytes = NULL;
+	size_t count = 0, i = 0, strsz = 0, off = 0;
+
+	memset(&key, 0x00, sizeof(key));
+	key.addr = addr;
+	key.length = length;
+	key.arch = arch;
+
+	HASH_FIND(hh, dcache, &key, sizeof(dcache_key_t), e);
+	if ((e) && (memcmp(e->bytes, (void *) addr, length))) {	// Code was modified since
+		dcache_drop(e);
+		e = NULL;
+	}
+	if (e) {		// Hit: move to the most recently used end
+		DL_DELETE(dcache_lru, e);
+		DL_APPEND(dcache_lru, e);
+		return e;
+	}
+
+	if (disasm_handle(arch, 0, &handle)) {
+		return NULL;
+	}
+
+	// Decode a snapshot, kept to validate later hits
+	bytes = malloc(length);
+	if (!bytes) {
+		return NULL;
+	}
+	memcpy(bytes, (void *) addr, length);
+
+	count = cs_disasm(handle, bytes, length, addr, 0, &insn);
+	if (!count) {
+		free(bytes);
+		return NULL;
+	}
+
+	/**
+	 * Copy the decoded instructions, with all their strings in one block
+	 */
+	for (i = 0; i < count; i++) {
+		strsz += strlen(insn[i].mnemonic) + strlen(insn[i].op_str) + 2;
+	}
+
+	e = calloc(1, sizeof(dcache_entry_t));
+	e->insns = calloc(count, sizeof(dinsn_t));
+	e->strs = calloc(1, strsz);
+	e->bytes = bytes;
+	e->key = key;
+	e->count = count;
+
+	for (i = 0; i < count; i++) {
+		e->insns[i].address = insn[i].address;
+		e->insns[i].size = insn[i].size;
+		e->insns[i].mnemonic = e->strs + off;
+		off += sprintf(e->strs + off, "%s", insn[i].mnemonic) + 1;
+		e->insns[i].op_str = e->strs + off;
+		off += sprintf(e->strs + off, "%s", insn[i].op_str) + 1;
+	}
+	cs_free(insn, count);
+
+	HASH_ADD(hh, dcache, key, sizeof(dcache_key_t), e);
+	DL_APPEND(dcache_lru, e);
+	dcache_insns += count;
+
+	if ((dcache_lo == 0 && dcache_hi == 0) || (addr < dcache_lo)) {
+		dcache_lo = addr;
+	}
+	if (addr + length > dcache_hi) {
+		dcache_hi = addr + length;
+	}
+
+	// Evict least recently used entries, never the one just added
+	while ((dcache_insns > DCACHE_MAX_INSNS) && (dcache_lru != e)) {
+		dcache_drop(dcache_lru);
+	}
+
+	return e;
+}
+
 /**
  * Get architecture info by name (including aliases)
  */
@@ -227,8 +397,11 @@ void register_binary_arch(const char *filename, unsigned long base_addr)
 	binary_arch_t *ba = binary_archs;
 	while (ba) {
 		if (strcmp(ba->filename, filename) == 0) {
-			ba->arch = arch;
-			ba->base_addr = base_addr;
+			if ((ba->arch != arch) || (ba->base_addr != base_addr)) {
+				ba->arch = arch;
+				ba->base_addr = base_addr;
+				arch_index.valid = 0;
+			}
 			return;
 		}
 		ba = ba->next;
@@ -241,6 +414,7 @@ void register_binary_arch(const char *filename, unsigned long base_addr)
 	ba->base_addr = base_addr;
 	ba->next = binary_archs;
 	binary_archs = ba;
+	arch_index.valid = 0;
 
 	// Set default if first binary
 	if (!default_arch) {
@@ -249,37 +423,60 @@ void register_binary_arch(const char *filename, unsigned long base_addr)
 }
 
 /**
- * Find architecture for address
+ * Rebuild the address -> architecture index from the segment list
  */
-arch_info_t *find_arch_for_address(unsigned long addr)
+static void build_arch_index(void)
 {
-	// Try to find which binary this address belongs to
-	binary_arch_t *ba = binary_archs;
-	while (ba) {
-		if (addr >= ba->base_addr) {
-			return ba->arch;
-		}
-		ba = ba->next;
+	extern wsh_t *wsh;
+	addrrange_t *items = NULL;
+	segments_t *seg = NULL;
+	binary_arch_t *ba = NULL;
+	unsigned int n = 0;
+
+	DL_COUNT(wsh->phdrs, seg, n);
+	items = calloc(n + 1, sizeof(addrrange_t));
+	if (!items) {
+		return;
 	}
 
-	// Try to find from loaded sections
-	extern wsh_t *wsh;	// Reference to global wsh
-	sections_t *s = wsh->shdrs;
-	while (s) {
-		if (addr >= s->addr && addr < s->addr + s->size) {
-			// Find binary that contains this section
-			binary_arch_t *ba = binary_archs;
-			while (ba) {
-				if (addr >= ba->base_addr && addr < ba->base_addr + 0x100000) {
-					return ba->arch;
-				}
-				ba = ba->next;
+	n = 0;
+	DL_FOREACH(wsh->phdrs, seg) {
+		if ((!seg->size) || (strcmp(seg->type, "PT_LOAD"))) {
+			continue;
+		}
+		for (ba = binary_archs; ba; ba = ba->next) {
+			if (!strcmp(ba->filename, seg->libname)) {
+				break;
 			}
 		}
-		s = s->next;
+		if (!ba) {
+			continue;
+		}
+		items[n].start = seg->addr;
+		items[n].end = seg->addr + seg->size - 1;
+		items[n++].item = ba->arch;
+	}
+
+	build_addr_index(&arch_index, items, n);
+	arch_index_gen = wsh->seggen;
+	free(items);
+}
+
+/**
+ * Find architecture for address: O(log n) lookup in the mapped segments of registered binaries
+ */
+arch_info_t *find_arch_for_address(unsigned long addr)
+{
+	extern wsh_t *wsh;	// Reference to global wsh
+	arch_info_t *arch = NULL;
+
+	if ((!arch_index.valid) || (arch_index_gen != wsh->seggen)) {
+		build_arch_index();
 	}
 
-	return default_arch;
+	arch = addr_index_lookup(&arch_index, addr);
+
+	return arch ? arch : default_arch;
 }
 
 /**
@@ -359,43 +556,31 @@ int disasm(lua_State *L)
 		printf("Recompile Capstone with support for this architecture\n");
 		return 0;
 	}
-	// Initialize capstone
-	csh handle;
-	cs_insn *insn;
-	size_t count;
-
-	if (cs_open(target_arch->arch, target_arch->mode, &handle)) {
-		printf("Error: Failed to initialize capstone for %s\n", target_arch->description);
-		return 0;
-	}
-
-	cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON);
-
-	// Disassemble
-	count = cs_disasm(handle, (uint8_t *) addr, length, addr, 0, &insn);
+	// Decode, or reuse a previous decoding of the same bytes
+	dcache_entry_t *dec = dcache_decode(target_arch, addr, length);
 
-	if (count > 0) {
+	if (dec) {
 		printf(BLUE "\n   Disassembly of 0x%lx (%u bytes) [%s]:\n\n" NORMAL, addr, length, target_arch->description);
 
 		lua_newtable(L);
 
-		for (size_t i = 0; i < count; i++) {
-			printf("  " GREEN "0x%lx:" NORMAL " %-12s %s\n", insn[i].address, insn[i].mnemonic, insn[i].op_str);
+		for (size_t i = 0; i < dec->count; i++) {
+			printf("  " GREEN "0x%lx:" NORMAL " %-12s %s\n", (unsigned long) dec->insns[i].address, dec->insns[i].mnemonic, dec->insns[i].op_str);
 
 			// Build Lua table entry
 			lua_pushinteger(L, i + 1);
 			lua_newtable(L);
 
 			lua_pushstring(L, "address");
-			lua_pushinteger(L, insn[i].address);
+			lua_pushinteger(L, dec->insns[i].address);
 			lua_settable(L, -3);
 
 			lua_pushstring(L, "mnemonic");
-			lua_pushstring(L, insn[i].mnemonic);
+			lua_pushstring(L, dec->insns[i].mnemonic);
 			lua_settable(L, -3);
 
 			lua_pushstring(L, "operands");
-			lua_pushstring(L, insn[i].op_str);
+			lua_pushstring(L, dec->insns[i].op_str);
 			lua_settable(L, -3);
 
 			lua_pushstring(L, "arch");
@@ -410,7 +595,6 @@ int disasm(lua_State *L)
 		}
 
 		printf(NORMAL "\n");
-		cs_free(insn, count);
 	} else {
 		printf("Error: Failed to disassemble %s code at 0x%lx\n", target_arch->description, addr);
 		printf("This could be due to:\n");
@@ -420,7 +604,6 @@ int disasm(lua_State *L)
 		lua_newtable(L);
 	}
 
-	cs_close(&handle);
 	return 1;
 }
 
@@ -475,6 +658,1332 @@ int disasm_sym(lua_State *L)
 	return disasm(L);
 }
 
+/**
+ * Smallest instruction size of an architecture: how far to skip on undecodable bytes
+ */
+static unsigned int arch_min_insn(arch_info_t *arch)
+{
+	switch (arch->arch) {
+	case CS_ARCH_ARM:
+		return (arch->mode & CS_MODE_THUMB) ? 2 : 4;
+	case CS_ARCH_ARM64:
+	case CS_ARCH_MIPS:
+	case CS_ARCH_PPC:
+	case CS_ARCH_SPARC:
+		return 4;
+	case CS_ARCH_SYSZ:
+	case CS_ARCH_M68K:
+		return 2;
+#ifdef CS_ARCH_RISCV
+	case CS_ARCH_RISCV:
+		return 2;
+#endif
+	default:
+		break;
+	}
+
+	return 1;
+}
+
+/**
+ * Return 1 if value is in the sorted array a
+ */
+static int dr_has_addr(const unsigned long *a, size_t n, unsigned long value)
+{
+	size_t lo = 0, hi = n, mid = 0;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (a[mid] < value) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return (lo < n) && (a[lo] == value);
+}
+
+/**
+ * Intern an operand string in a chunk, return its local id
+ */
+static unsigned int dr_intern(dr_chunk_t *c, const char *str)
+{
+	dr_string_t *s = NULL;
+
+	HASH_FIND_STR(c->strings, str, s);
+	if (s) {
+		return s->id;
+	}
+
+	s = calloc(1, sizeof(dr_string_t));
+	s->str = strdup(str);
+	s->id = c->nstrings;
+	HASH_ADD_KEYPTR(hh, c->strings, s->str, strlen(s->str), s);
+
+	if (c->nstrings == c->maxstrings) {
+		c->maxstrings = c->maxstrings ? c->maxstrings * 2 : 256;
+		c->strtab = realloc(c->strtab, c->maxstrings * sizeof(char *));
+	}
+	c->strtab[c->nstrings++] = s->str;
+
+	return s->id;
+}
+
+/**
+ * Decode a chunk: every instruction starting in [start, end).
+ * The last one may extend up to limit. If sync is set, stop as soon as
+ * decoding reaches one of its addresses (resynchronisation).
+ */
+static void *dr_decode(void *arg)
+{
+	dr_chunk_t *c = arg;
+	const uint8_t *code = (const uint8_t *) c->start;
+	size_t remaining = c->limit - c->start;
+	uint64_t address = c->start;
+	unsigned int skip = arch_min_insn(c->arch);
+	cs_insn *insn = NULL;
+	csh handle;
+
+	c->next = c->start;
+
+	// Capstone handles are not thread safe: one per chunk
+	if (cs_open(c->arch->arch, c->arch->mode, &handle)) {
+		c->err = 1;
+		return NULL;
+	}
+	insn = cs_malloc(handle);
+
+	while ((address < c->end) && (remaining)) {
+		if ((c->sync) && (address != c->start) && (dr_has_addr(c->sync, c->nsync, address))) {
+			break;
+		}
+
+		if (!cs_disasm_iter(handle, &code, &remaining, &address, insn)) {
+			// Undecodable bytes: skip them, like CS_OPT_SKIPDATA without output
+			if (remaining <= skip) {
+				address += remaining;
+				remaining = 0;
+				break;
+			}
+			code += skip;
+			remaining -= skip;
+			address += skip;
+			continue;
+		}
+
+		if (c->count == c->max) {
+			c->max = c->max ? c->max * 2 : 4096;
+			c->addr = realloc(c->addr, c->max * sizeof(unsigned long));
+			c->size = realloc(c->size, c->max * sizeof(int));
+			c->id = realloc(c->id, c->max * sizeof(int));
+			c->op = realloc(c->op, c->max * sizeof(int));
+		}
+
+		c->addr[c->count] = insn->address;
+		c->size[c->count] = insn->size;
+		c->id[c->count] = insn->id;
+		c->op[c->count] = (c->fields & DR_FIELD_OPERANDS) ? dr_intern(c, insn->op_str) : 0;
+		c->count++;
+	}
+
+	c->next = address;
+
+	cs_free(insn, 1);
+	cs_close(&handle);
+	return NULL;
+}
+
+/**
+ * Release a chunk
+ */
+static void dr_free(dr_chunk_t *c)
+{
+	dr_string_t *s = NULL, *tmp = NULL;
+
+	HASH_ITER(hh, c->strings, s, tmp) {
+		HASH_DEL(c->strings, s);
+		free(s->str);
+		free(s);
+	}
+	free(c->strtab);
+	free(c->addr);
+	free(c->size);
+	free(c->id);
+	free(c->op);
+}
+
+/**
+ * Append instructions [from, c->count) of a chunk to the result columns,
+ * remapping its operand ids to global ones
+ */
+static void dr_append(dr_result_t *r, dr_chunk_t *c, size_t from)
+{
+	unsigned int *map = NULL;
+	size_t i = 0, n = c->count - from;
+
+	if (from >= c->count) {
+		return;
+	}
+
+	if (r->count + n > r->max) {
+		r->max = (r->count + n) * 2;
+		r->addr = realloc(r->addr, r->max * sizeof(long));
+		r->size = realloc(r->size, r->max * sizeof(int));
+		r->id = realloc(r->id, r->max * sizeof(int));
+		r->op = realloc(r->op, r->max * sizeof(int));
+	}
+
+	if (c->fields & DR_FIELD_OPERANDS) {
+		map = calloc(c->nstrings ? c->nstrings : 1, sizeof(unsigned int));
+		for (i = 0; i < c->nstrings; i++) {
+			map[i] = dr_intern(&r->strings, c->strtab[i]);
+		}
+	}
+
+	for (i = from; i < c->count; i++) {
+		r->addr[r->count] = c->addr[i];
+		r->size[r->count] = c->size[i];
+		r->id[r->count] = c->id[i];
+		r->op[r->count] = map ? (int) map[c->op[i]] : 0;
+		r->count++;
+	}
+
+	free(map);
+}
+
+/**
+ * Parse the fields option: a table or a comma separated string of column names
+ */
+static unsigned int dr_parse_fields(lua_State *L, int idx)
+{
+	static const char *names[] = { "address", "size", "mnemonic", "operands" };
+	unsigned int fields = 0, i = 0;
+	const char *str = NULL;
+
+	if (lua_isstring(L, idx)) {
+		str = lua_tostring(L, idx);
+		for (i = 0; i < sizeof(names) / sizeof(char *); i++) {
+			if (strstr(str, names[i])) {
+				fields |= 1 << i;
+			}
+		}
+	} else if (lua_istable(L, idx)) {
+		for (int j = 1; j <= (int) lua_rawlen(L, idx); j++) {
+			lua_rawgeti(L, idx, j);
+			str = lua_tostring(L, -1);
+			for (i = 0; (str) && (i < sizeof(names) / sizeof(char *)); i++) {
+				if (!strcmp(str, names[i])) {
+					fields |= 1 << i;
+				}
+			}
+			lua_pop(L, 1);
+		}
+	}
+
+	return fields ? fields : DR_FIELD_ALL;
+}
+
+/**
+ * Bulk disassembly: disasm_range(address, length, {arch, quiet, fields, threads})
+ *
+ * Returns a table of columns, all indexed from 0:
+ *   address, size, mnemonic (capstone instruction id), operands (index in strings) as carrays,
+ *   strings (carray of unique operand strings), mnemonics (table: instruction id -> name), count.
+ */
+int disasm_range(lua_State *L)
+{
+	unsigned long int addr = 0, len = 0, chunksz = 0;
+	arch_info_t *target_arch = NULL;
+	unsigned int threads = 1, quiet = 0, fields = DR_FIELD_ALL;
+	unsigned int i = 0;
+	dr_chunk_t *chunks = NULL, bridge;
+	dr_result_t r;
+	pthread_t *tids = NULL;
+	unsigned long pos = 0;
+	size_t j = 0;
+	csh handle;
+
+	if ((lua_gettop(L) < 2) || (!lua_isnumber(L, 1)) || (!lua_isnumber(L, 2))) {
+		printf("Usage: disasm_range(address, length, {arch, quiet, fields, threads})\n");
+		return 0;
+	}
+
+	addr = (unsigned long int) lua_tonumber(L, 1);
+	len = (unsigned long int) lua_tonumber(L, 2);
+
+	if (lua_istable(L, 3)) {
+		lua_getfield(L, 3, "arch");
+		if (lua_isstring(L, -1)) {
+			target_arch = get_arch_by_name(lua_tostring(L, -1));
+			if (!target_arch) {
+				printf("Error: Unknown architecture '%s'\n", lua_tostring(L, -1));
+				lua_pop(L, 1);
+				return 0;
+			}
+		}
+		lua_getfield(L, 3, "quiet");
+		quiet = lua_toboolean(L, -1);
+		lua_getfield(L, 3, "threads");
+		threads = lua_tointeger(L, -1);
+		lua_getfield(L, 3, "fields");
+		if (!lua_isnil(L, -1)) {
+			fields = dr_parse_fields(L, lua_gettop(L));
+		}
+		lua_pop(L, 4);
+	}
+
+	if (!target_arch) {
+		target_arch = find_arch_for_address(addr);
+		if (!target_arch) {
+			target_arch = default_arch ? default_arch : &supported_archs[1];	// x86_64 fallback
+		}
+	}
+
+	if (!cs_support(target_arch->arch)) {
+		printf("Error: Architecture %s (%s) not supported by this Capstone build\n", target_arch->name, target_arch->description);
+		return 0;
+	}
+
+	if ((!len) || (addr + len < addr)) {
+		printf("Error: Invalid range 0x%lx-0x%lx\n", addr, addr + len);
+		return 0;
+	}
+
+	// Every page of the range must be readable
+	if ((strcmp(target_arch->category, "VM") != 0) && (msync((void *) (addr & ~0xfff), ((addr + len + 0xfff) & ~0xfff) - (addr & ~0xfff), MS_ASYNC))) {
+		printf("Error: Memory at 0x%lx-0x%lx is not entirely accessible\n", addr, addr + len);
+		return 0;
+	}
+
+	/**
+	 * Decode chunks in parallel, each from its own (possibly misaligned) start
+	 */
+	if (threads < 1) {
+		threads = 1;
+	}
+	if (threads > DR_MAX_THREADS) {
+		threads = DR_MAX_THREADS;
+	}
+	if (len / threads < DR_MIN_CHUNK) {
+		threads = len / DR_MIN_CHUNK ? len / DR_MIN_CHUNK : 1;
+	}
+	chunksz = len / threads;
+
+	chunks = calloc(threads, sizeof(dr_chunk_t));
+	tids = calloc(threads, sizeof(pthread_t));
+	for (i = 0; i < threads; i++) {
+		chunks[i].arch = target_arch;
+		chunks[i].fields = fields;
+		chunks[i].start = addr + i * chunksz;
+		chunks[i].end = (i == threads - 1) ? addr + len : addr + (i + 1) * chunksz;
+		chunks[i].limit = addr + len;
+	}
+
+	if (threads == 1) {
+		dr_decode(&chunks[0]);
+	} else {
+		for (i = 0; i < threads; i++) {
+			if (pthread_create(&tids[i], NULL, dr_decode, &chunks[i])) {
+				tids[i] = 0;
+				dr_decode(&chunks[i]);
+			}
+		}
+		for (i = 0; i < threads; i++) {
+			if (tids[i]) {
+				pthread_join(tids[i], NULL);
+			}
+		}
+	}
+
+	/**
+	 * Stitch chunks: keep the instructions of chunk k from the address where
+	 * sequential decoding of the previous chunks ended. If chunk k never
+	 * decoded from that address, decode from it until both streams agree.
+	 */
+	memset(&r, 0x00, sizeof(r));
+	pos = addr;
+	for (i = 0; i < threads; i++) {
+		dr_chunk_t *c = &chunks[i];
+
+		if (c->err) {
+			printf("Error: Failed to initialize capstone for %s\n", target_arch->description);
+			break;
+		}
+
+		if (pos >= c->end) {	// Entirely covered by the previous instruction
+			continue;
+		}
+
+		if (!dr_has_addr(c->addr, c->count, pos)) {
+			memset(&bridge, 0x00, sizeof(bridge));
+			bridge.arch = target_arch;
+			bridge.fields = fields;
+			bridge.start = pos;
+			bridge.end = c->end;
+			bridge.limit = c->limit;
+			bridge.sync = c->addr;
+			bridge.nsync = c->count;
+			dr_decode(&bridge);
+			dr_append(&r, &bridge, 0);
+			dr_free(&bridge);
+			pos = bridge.next;
+			if (pos >= c->end) {
+				continue;
+			}
+		}
+
+		for (j = 0; (j < c->count) && (c->addr[j] < pos); j++);
+		dr_append(&r, c, j);
+		pos = c->next;
+	}
+
+	for (i = 0; i < threads; i++) {
+		dr_free(&chunks[i]);
+	}
+	free(chunks);
+	free(tids);
+
+	if (!quiet) {
+		printf(BLUE "\n   Disassembled %lu instructions at 0x%lx (%lu bytes) [%s]\n\n" NORMAL, (unsigned long) r.count, addr, len, target_arch->description);
+	}
+
+	/**
+	 * Return columns as carrays. Ownership of the arrays moves to lua.
+	 */
+	lua_newtable(L);
+
+	lua_pushinteger(L, r.count);
+	lua_setfield(L, -2, "count");
+
+	if (fields & DR_FIELD_ADDRESS) {
+		carray_push(L, r.addr, r.count, CARRAY_LONG);
+		lua_setfield(L, -2, "address");
+		r.addr = NULL;
+	}
+
+	if (fields & DR_FIELD_SIZE) {
+		carray_push(L, r.size, r.count, CARRAY_INT);
+		lua_setfield(L, -2, "size");
+		r.size = NULL;
+	}
+
+	if (fields & DR_FIELD_MNEMONIC) {
+		carray_push(L, r.id, r.count, CARRAY_INT);
+		lua_setfield(L, -2, "mnemonic");
+
+		// Instruction id -> name, for the ids present
+		lua_newtable(L);
+		if (!disasm_handle(target_arch, 0, &handle)) {
+			for (j = 0; j < r.count; j++) {
+				lua_rawgeti(L, -1, r.id[j]);
+				if (lua_isnil(L, -1)) {
+					const char *name = cs_insn_name(handle, r.id[j]);
+					lua_pushstring(L, name ? name : "");
+					lua_rawseti(L, -3, r.id[j]);
+				}
+				lua_pop(L, 1);
+			}
+		}
+		lua_setfield(L, -2, "mnemonics");
+		r.id = NULL;
+	}
+
+	if (fields & DR_FIELD_OPERANDS) {
+		carray_push(L, r.op, r.count, CARRAY_INT);
+		lua_setfield(L, -2, "operands");
+		r.op = NULL;
+
+		// The carray frees each string: hand them over and drop the index only
+		carray_push(L, r.strings.strtab, r.strings.nstrings, CARRAY_CHARPTR);
+		lua_setfield(L, -2, "strings");
+		r.strings.strtab = NULL;
+		{
+			dr_string_t *s = NULL, *tmp = NULL;
+			HASH_ITER(hh, r.strings.strings, s, tmp) {
+				HASH_DEL(r.strings.strings, s);
+				free(s);
+			}
+		}
+	}
+
+	dr_free(&r.strings);
+	free(r.addr);
+	free(r.size);
+	free(r.id);
+	free(r.op);
+
+	return 1;
+}
+
+/**
+ * Reference graph, see xrefs()
+ */
+static xref_graph_t xgraph;
+
+/**
+ * Release the reference graph
+ */
+static void xref_free(void)
+{
+	unsigned int i = 0;
+
+	for (i = 0; i < xgraph.nlocals; i++) {
+		free(xgraph.locals[i].symbol);
+	}
+	free(xgraph.locals);
+	free(xgraph.nodes);
+	free(xgraph.idx.ranges);
+	free(xgraph.out_off);
+	free(xgraph.out_dst);
+	free(xgraph.out_kind);
+	free(xgraph.in_off);
+	free(xgraph.in_src);
+	free(xgraph.in_kind);
+	memset(&xgraph, 0x00, sizeof(xgraph));
+}
+
+/**
+ * Graph node (symbol) containing an address, -1 if none
+ */
+static int xref_node_at(unsigned long addr)
+{
+	void *item = addr_index_lookup(&xgraph.idx, addr);
+
+	return item ? (int) ((uintptr_t) item - 1) : -1;
+}
+
+/**
+ * Record a reference found in code. References are kept raw: they are only
+ * resolved to symbols when linking the graph, so caches don't depend on the
+ * symbols known when they were written.
+ */
+static void xref_add(xref_job_t *j, unsigned long src, unsigned long dst, unsigned int kind)
+{
+	if (j->count == j->max) {
+		j->max = j->max ? j->max * 2 : 1024;
+		j->edges = realloc(j->edges, j->max * sizeof(xref_edge_t));
+	}
+	j->edges[j->count].src = src;
+	j->edges[j->count].dst = dst;
+	j->edges[j->count].kind = kind;
+	j->edges[j->count].pad = 0;
+	j->count++;
+}
+
+/**
+ * Direct targets of an x86 instruction: call/jmp immediates and RIP-relative operands.
+ * A RIP-relative operand of a call/jmp is a branch through memory (GOT slot): it keeps the branch kind.
+ */
+static void xref_scan_insn(xref_job_t *j, cs_insn *insn)
+{
+	cs_x86 *x86 = &insn->detail->x86;
+	unsigned int kind = 0, i = 0;
+
+	for (i = 0; i < insn->detail->groups_count; i++) {
+		if (insn->detail->groups[i] == CS_GRP_CALL) {
+			kind = XREF_CALL;
+		} else if ((insn->detail->groups[i] == CS_GRP_JUMP) && (!kind)) {
+			kind = XREF_JUMP;
+		}
+	}
+
+	for (i = 0; i < x86->op_count; i++) {
+		cs_x86_op *op = &x86->operands[i];
+
+		if ((kind) && (op->type == X86_OP_IMM)) {
+			xref_add(j, insn->address, op->imm, kind);
+		} else if ((op->type == X86_OP_MEM) && (op->mem.base == X86_REG_RIP)) {
+			xref_add(j, insn->address, insn->address + insn->size + op->mem.disp, kind | XREF_DATA);
+		}
+	}
+}
+
+/**
+ * Worker: decode sections from the pool until none is left
+ */
+static void *xref_decode(void *arg)
+{
+	xref_pool_t *pool = arg;
+	arch_info_t *arch = NULL;
+	cs_insn *insn = NULL;
+	unsigned int n = 0;
+	csh handle;
+
+	while ((n = __sync_fetch_and_add(&pool->next, 1)) < pool->njobs) {
+		xref_job_t *j = &pool->jobs[n];
+		const uint8_t *code = (const uint8_t *) j->start;
+		size_t remaining = j->end - j->start;
+		uint64_t address = j->start;
+		unsigned int skip = arch_min_insn(j->arch);
+
+		// Capstone handles are not thread safe: one per worker and architecture
+		if (j->arch != arch) {
+			if (arch) {
+				cs_free(insn, 1);
+				cs_close(&handle);
+				arch = NULL;
+			}
+			if (cs_open(j->arch->arch, j->arch->mode, &handle)) {
+				j->err = 1;
+				continue;
+			}
+			cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON);
+			insn = cs_malloc(handle);
+			arch = j->arch;
+		}
+
+		while (remaining) {
+			if (!cs_disasm_iter(handle, &code, &remaining, &address, insn)) {
+				if (remaining <= skip) {
+					break;
+				}
+				code += skip;
+				remaining -= skip;
+				address += skip;
+				continue;
+			}
+			xref_scan_insn(j, insn);
+		}
+	}
+
+	if (arch) {
+		cs_free(insn, 1);
+		cs_close(&handle);
+	}
+	return NULL;
+}
+
+/**
+ * Read the cached references of an object
+ */
+static int xref_load(xref_object_t *o)
+{
+	xref_hdr_t *hdr = NULL;
+	xref_edge_t *edges = NULL;
+	size_t mapsz = 0, tailsz = 0, i = 0;
+
+	hdr = cache_map(o->path, XREF_MAGIC, XREF_VERSION, sizeof(xref_edge_t), sizeof(xref_hdr_t), &mapsz, &tailsz);
+	if (!hdr) {
+		return -1;
+	}
+	if (tailsz) {
+		munmap(hdr, mapsz);
+		return -1;
+	}
+
+	edges = (xref_edge_t *) (hdr + 1);
+	o->count = hdr->nentries;
+	o->edges = calloc(o->count + 1, sizeof(xref_edge_t));
+	for (i = 0; i < o->count; i++) {
+		o->edges[i] = edges[i];
+		o->edges[i].src += o->base;
+		o->edges[i].dst += o->base;
+	}
+
+	munmap(hdr, mapsz);
+	return 0;
+}
+
+/**
+ * Write the references of an object to its cache file, relative to its base
+ */
+static int xref_save(xref_object_t *o)
+{
+	xref_hdr_t hdr;
+	xref_edge_t *edges = NULL;
+	size_t i = 0;
+	int ret = 0;
+
+	edges = calloc(o->count + 1, sizeof(xref_edge_t));
+	if (!edges) {
+		return -1;
+	}
+	for (i = 0; i < o->count; i++) {
+		edges[i] = o->edges[i];
+		edges[i].src -= o->base;
+		edges[i].dst -= o->base;
+	}
+
+	memset(&hdr, 0x00, sizeof(hdr));
+	ret = cache_write(o->path, XREF_MAGIC, XREF_VERSION, sizeof(xref_edge_t), &hdr, sizeof(hdr), edges, o->count, NULL, 0);
+	free(edges);
+	return ret;
+}
+
+/**
+ * Sort references by source, then destination
+ */
+static int xref_link_cmp(const void *a, const void *b)
+{
+	const xref_link_t *x = a, *y = b;
+
+	if (x->src != y->src) {
+		return x->src < y->src ? -1 : 1;
+	}
+	if (x->dst != y->dst) {
+		return x->dst < y->dst ? -1 : 1;
+	}
+	return 0;
+}
+
+/**
+ * Sort addresses
+ */
+static int xref_addr_cmp(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *) a, y = *(const unsigned long *) b;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/**
+ * Is [addr, addr + len) mapped ?
+ */
+static int xref_mapped(unsigned long addr, size_t len)
+{
+	return !msync((void *) (addr & ~0xfff), ((addr + len + 0xfff) & ~0xfff) - (addr & ~0xfff), MS_ASYNC);
+}
+
+/**
+ * Final target of a PLT stub or GOT slot in section sec, 0 if none.
+ * Slots are read in place: wsh loads objects with RTLD_NOW, so they are bound.
+ */
+static unsigned long xref_indirect(csh handle, sections_t *sec, unsigned long addr)
+{
+	arch_info_t *arch = NULL;
+	cs_insn *insn = NULL;
+	unsigned long slot = 0, target = 0;
+	size_t count = 0, len = 0, i = 0;
+
+	if (!strncmp(sec->name, ".plt", 4)) {
+		// .plt, .plt.got, .plt.sec: [endbr64] [bnd] jmp *slot(%rip)
+		arch = find_arch_for_address(addr);
+		len = sec->addr + sec->size - addr;
+		len = len > 16 ? 16 : len;
+		if ((!handle) || (!arch) || (arch->arch != CS_ARCH_X86) || (arch->mode != CS_MODE_64) || (!xref_mapped(addr, len))) {
+			return 0;
+		}
+
+		count = cs_disasm(handle, (const uint8_t *) addr, len, addr, 0, &insn);
+		for (i = 0; (i < count) && (!slot); i++) {
+			cs_x86 *x86 = &insn[i].detail->x86;
+
+			if ((insn[i].id == X86_INS_JMP) && (x86->op_count == 1) && (x86->operands[0].type == X86_OP_MEM) && (x86->operands[0].mem.base == X86_REG_RIP)) {
+				slot = insn[i].address + insn[i].size + x86->operands[0].mem.disp;
+			} else if ((insn[i].id == X86_INS_JMP) || (insn[i].id == X86_INS_RET)) {
+				break;	// Lazy binding stub, or not a stub
+			}
+		}
+		if (count) {
+			cs_free(insn, count);
+		}
+
+		sec = slot ? section_from_addr(slot) : NULL;
+		if ((!sec) || (!sec->name)) {
+			return 0;
+		}
+		addr = slot;
+	}
+
+	// .got, .got.plt
+	if ((strncmp(sec->name, ".got", 4)) || (addr + sizeof(target) > sec->addr + sec->size) || (!xref_mapped(addr, sizeof(target)))) {
+		return 0;
+	}
+	memcpy(&target, (void *) addr, sizeof(target));
+	return target;
+}
+
+/**
+ * Final target of a reference to a PLT stub or a GOT slot, memoized. 0 for other references.
+ */
+static unsigned long xref_resolve(xref_stub_t **stubs, csh handle, unsigned long addr)
+{
+	sections_t *sec = section_from_addr(addr);
+	xref_stub_t *st = NULL;
+
+	if ((!sec) || (!sec->name) || ((strncmp(sec->name, ".plt", 4)) && (strncmp(sec->name, ".got", 4)))) {
+		return 0;
+	}
+
+	HASH_FIND(hh, *stubs, &addr, sizeof(addr), st);
+	if (st) {
+		return st->target;
+	}
+
+	st = calloc(1, sizeof(xref_stub_t));
+	if (!st) {
+		return xref_indirect(handle, sec, addr);
+	}
+	st->addr = addr;
+	st->target = xref_indirect(handle, sec, addr);
+	HASH_ADD(hh, *stubs, addr, sizeof(st->addr), st);
+	return st->target;
+}
+
+/**
+ * Make up nodes for called functions without a symbol (static functions), named sub_<addr>.
+ * Each extends to the next function start or the end of its section.
+ * Returns the number of nodes made, in xgraph.locals.
+ */
+static unsigned int xref_locals(xref_object_t *objects)
+{
+	extern wsh_t *wsh;
+	xref_object_t *o = NULL;
+	symbols_t *sym = NULL;
+	unsigned long *calls = NULL, *starts = NULL;
+	size_t ncalls = 0, maxcalls = 0, nstarts = 0, k = 0, e = 0;
+	char name[32];
+
+	LL_FOREACH(objects, o) {
+		for (k = 0; k < o->count; k++) {
+			if ((!(o->edges[k].kind & XREF_CALL)) || (xref_node_at(o->edges[k].dst) >= 0)) {
+				continue;
+			}
+			if (ncalls == maxcalls) {
+				maxcalls = maxcalls ? maxcalls * 2 : 1024;
+				calls = realloc(calls, maxcalls * sizeof(unsigned long));
+			}
+			calls[ncalls++] = o->edges[k].dst;
+		}
+	}
+	if (!ncalls) {
+		return 0;
+	}
+
+	qsort(calls, ncalls, sizeof(unsigned long), xref_addr_cmp);
+	for (k = 0, e = 0; k < ncalls; k++) {
+		if ((!e) || (calls[e - 1] != calls[k])) {
+			calls[e++] = calls[k];
+		}
+	}
+	ncalls = e;
+
+	// Function starts, to bound the made up ones
+	starts = calloc(xgraph.nnodes + ncalls + 1, sizeof(unsigned long));
+	xgraph.locals = calloc(ncalls + 1, sizeof(symbols_t));
+	if ((!starts) || (!xgraph.locals)) {
+		free(calls);
+		free(starts);
+		return 0;
+	}
+	for (k = 0; k < xgraph.nnodes; k++) {
+		starts[nstarts++] = xgraph.nodes[k]->addr;
+	}
+	memcpy(starts + nstarts, calls, ncalls * sizeof(unsigned long));
+	nstarts += ncalls;
+	qsort(starts, nstarts, sizeof(unsigned long), xref_addr_cmp);
+
+	for (k = 0; k < ncalls; k++) {
+		sections_t *sec = section_from_addr(calls[k]);
+		size_t lo = 0, hi = nstarts;
+		unsigned long end = 0;
+
+		if ((!sec) || (!(sec->flags & SHF_EXECINSTR)) || (calls[k] >= sec->addr + sec->size) || ((sec->name) && (!strncmp(sec->name, ".plt", 4)))) {
+			continue;	// Not code, or an unresolved PLT stub
+		}
+
+		// First start after calls[k]
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+			if (starts[mid] <= calls[k]) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		end = sec->addr + sec->size;
+		if ((lo < nstarts) && (starts[lo] < end)) {
+			end = starts[lo];
+		}
+
+		snprintf(name, sizeof(name), "sub_%lx", calls[k]);
+		sym = &xgraph.locals[xgraph.nlocals++];
+		sym->addr = calls[k];
+		sym->size = end - calls[k];
+		sym->symbol = strdup(name);
+		sym->libname = sec->libname;
+		sym->htype = "FUNC";
+		sym->hbind = "LOCAL";
+	}
+
+	free(calls);
+	free(starts);
+	return xgraph.nlocals;
+}
+
+/**
+ * Build the reference graph: decode every executable section of every loaded object
+ * once (or read its references from ~/.wsh/cache), then index them by symbol.
+ * Calls through PLT stubs and GOT slots are linked to their final targets,
+ * called functions without a symbol get a sub_<addr> node.
+ */
+static int xref_build(void)
+{
+	extern wsh_t *wsh;
+	symbols_t *sym = NULL;
+	sections_t *sec = NULL;
+	addrrange_t *items = NULL;
+	xref_object_t *objects = NULL, *o = NULL, *otmp = NULL;
+	xref_job_t *jobs = NULL;
+	xref_link_t *links = NULL;
+	xref_stub_t *stubs = NULL, *st = NULL, *sttmp = NULL;
+	arch_info_t *x64 = NULL;
+	xref_pool_t pool;
+	pthread_t *tids = NULL;
+	unsigned int n = 0, njobs = 0, maxjobs = 0, threads = 0, i = 0;
+	size_t nlinks = 0, k = 0, e = 0;
+	long ncpu = 0;
+	csh handle = 0;
+
+	xref_free();
+
+	/**
+	 * One job per mapped executable section, unless its object is cached
+	 */
+	DL_FOREACH(wsh->shdrs, sec) {
+		arch_info_t *arch = NULL;
+
+		if ((!(sec->flags & SHF_EXECINSTR)) || (!sec->addr) || (!sec->size)) {
+			continue;
+		}
+
+		arch = find_arch_for_address(sec->addr);
+		if ((!arch) || (arch->arch != CS_ARCH_X86)) {
+			continue;	// Branch targets are only resolved on x86
+		}
+
+		LL_FOREACH(objects, o) {
+			if (!strcmp(o->libname, sec->libname)) {
+				break;
+			}
+		}
+		if (!o) {
+			o = calloc(1, sizeof(xref_object_t));
+			o->libname = sec->libname;
+			if ((wsh->opt_nosymcache) || (cache_path((void *) sec->addr, sec->libname, "xref", o->path, sizeof(o->path), &o->base))) {
+				o->path[0] = 0x00;
+			} else if (!xref_load(o)) {
+				o->cached = 1;
+				xgraph.ncached++;
+			}
+			LL_APPEND(objects, o);
+		}
+
+		if (o->cached) {
+			xgraph.nsections++;
+			continue;
+		}
+
+		if (!xref_mapped(sec->addr, sec->size)) {
+			o->partial = 1;
+			continue;
+		}
+
+		xgraph.nsections++;
+
+		if (njobs == maxjobs) {
+			maxjobs = maxjobs ? maxjobs * 2 : 64;
+			jobs = realloc(jobs, maxjobs * sizeof(xref_job_t));
+		}
+		memset(&jobs[njobs], 0x00, sizeof(xref_job_t));
+		jobs[njobs].start = sec->addr;
+		jobs[njobs].end = sec->addr + sec->size;
+		jobs[njobs].arch = arch;
+		jobs[njobs].obj = o;
+		njobs++;
+	}
+
+	/**
+	 * Decode on a thread pool
+	 */
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	threads = ncpu > 0 ? (unsigned int) ncpu : 1;
+	threads = threads > DR_MAX_THREADS ? DR_MAX_THREADS : threads;
+	threads = threads > njobs ? njobs : threads;
+
+	memset(&pool, 0x00, sizeof(pool));
+	pool.jobs = jobs;
+	pool.njobs = njobs;
+	tids = calloc(threads + 1, sizeof(pthread_t));
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&tids[i], NULL, xref_decode, &pool)) {
+			tids[i] = 0;
+		}
+	}
+	xref_decode(&pool);	// Also work from this thread, in case no thread could start
+	for (i = 0; i < threads; i++) {
+		if (tids[i]) {
+			pthread_join(tids[i], NULL);
+		}
+	}
+	free(tids);
+
+	for (i = 0; i < njobs; i++) {
+		o = jobs[i].obj;
+		o->partial |= jobs[i].err;
+		o->edges = realloc(o->edges, (o->count + jobs[i].count + 1) * sizeof(xref_edge_t));
+		memcpy(o->edges + o->count, jobs[i].edges, jobs[i].count * sizeof(xref_edge_t));
+		o->count += jobs[i].count;
+		free(jobs[i].edges);
+	}
+	free(jobs);
+
+	/**
+	 * Persist fresh references, raw and complete ones only.
+	 * Then resolve references through PLT stubs and GOT slots.
+	 */
+	x64 = get_arch_by_name("x86_64");
+	if ((!x64) || (cs_open(x64->arch, x64->mode, &handle))) {
+		handle = 0;
+	} else {
+		cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON);
+	}
+
+	LL_FOREACH(objects, o) {
+		if ((!o->cached) && (!o->partial) && (o->path[0]) && (xref_save(o)) && (wsh->opt_verbose)) {
+			fprintf(stderr, "Warning: could not write %s\n", o->path);
+		}
+		for (k = 0; k < o->count; k++) {
+			unsigned long target = xref_resolve(&stubs, handle, o->edges[k].dst);
+			unsigned int kind = o->edges[k].kind;
+
+			if (target) {
+				o->edges[k].dst = target;
+				o->edges[k].kind = (kind & XREF_CODE) ? kind & XREF_CODE : XREF_DATA;
+			} else if (kind & XREF_DATA) {
+				o->edges[k].kind = XREF_DATA;	// Branch through memory: references the pointer
+			}
+		}
+		nlinks += o->count;
+	}
+
+	HASH_ITER(hh, stubs, st, sttmp) {
+		HASH_DEL(stubs, st);
+		free(st);
+	}
+	if (handle) {
+		cs_close(&handle);
+	}
+
+	/**
+	 * Nodes: every symbol with an address, then called functions without one
+	 */
+	DL_COUNT(wsh->symbols, sym, n);
+	xgraph.nodes = calloc(n + 1, sizeof(symbols_t *));
+	items = calloc(n + 1, sizeof(addrrange_t));
+	if ((!xgraph.nodes) || (!items)) {
+		free(items);
+		LL_FOREACH_SAFE(objects, o, otmp) {
+			LL_DELETE(objects, o);
+			free(o->edges);
+			free(o);
+		}
+		xref_free();
+		return -1;
+	}
+
+	n = 0;
+	DL_FOREACH(wsh->symbols, sym) {
+		if (!sym->addr) {
+			continue;
+		}
+		xgraph.nodes[n] = sym;
+		items[n].start = sym->addr;
+		items[n].end = sym->size ? sym->addr + sym->size - 1 : sym->addr;
+		items[n].item = (void *) (uintptr_t) (n + 1);
+		n++;
+	}
+	xgraph.nnodes = n;
+	build_addr_index(&xgraph.idx, items, n);
+
+	if (xref_locals(objects)) {
+		symbols_t **nodes = realloc(xgraph.nodes, (n + xgraph.nlocals + 1) * sizeof(symbols_t *));
+		addrrange_t *all = calloc(n + xgraph.nlocals + 1, sizeof(addrrange_t));
+
+		if ((nodes) && (all)) {
+			// Made up nodes first: where they overlap a symbol, the symbol wins
+			for (i = 0; i < xgraph.nlocals; i++) {
+				nodes[n + i] = &xgraph.locals[i];
+				all[i].start = xgraph.locals[i].addr;
+				all[i].end = xgraph.locals[i].addr + xgraph.locals[i].size - 1;
+				all[i].item = (void *) (uintptr_t) (n + i + 1);
+			}
+			memcpy(all + xgraph.nlocals, items, n * sizeof(addrrange_t));
+			xgraph.nnodes = n + xgraph.nlocals;
+			build_addr_index(&xgraph.idx, all, xgraph.nnodes);
+		}
+		if (nodes) {
+			xgraph.nodes = nodes;
+		}
+		free(all);
+	}
+	free(items);
+
+	/**
+	 * Resolve references to symbols
+	 */
+	links = calloc(nlinks + 1, sizeof(xref_link_t));
+
+	nlinks = 0;
+	LL_FOREACH_SAFE(objects, o, otmp) {
+		for (k = 0; k < o->count; k++) {
+			int from = xref_node_at(o->edges[k].src), to = xref_node_at(o->edges[k].dst);
+
+			if ((from < 0) || (to < 0) || ((from == to) && (o->edges[k].kind != XREF_CALL))) {
+				continue;
+			}
+			links[nlinks].src = from;
+			links[nlinks].dst = to;
+			links[nlinks].kind = o->edges[k].kind;
+			nlinks++;
+		}
+		LL_DELETE(objects, o);
+		free(o->edges);
+		free(o);
+	}
+
+	// Merge duplicate references, keeping all their kinds
+	qsort(links, nlinks, sizeof(xref_link_t), xref_link_cmp);
+	for (k = 0, e = 0; k < nlinks; k++) {
+		if ((e) && (links[e - 1].src == links[k].src) && (links[e - 1].dst == links[k].dst)) {
+			links[e - 1].kind |= links[k].kind;
+			continue;
+		}
+		links[e++] = links[k];
+	}
+	nlinks = e;
+
+	/**
+	 * Compressed sparse rows, both directions
+	 */
+	xgraph.nedges = nlinks;
+	xgraph.out_off = calloc(xgraph.nnodes + 1, sizeof(unsigned int));
+	xgraph.in_off = calloc(xgraph.nnodes + 1, sizeof(unsigned int));
+	xgraph.out_dst = calloc(nlinks + 1, sizeof(unsigned int));
+	xgraph.out_kind = calloc(nlinks + 1, sizeof(unsigned char));
+	xgraph.in_src = calloc(nlinks + 1, sizeof(unsigned int));
+	xgraph.in_kind = calloc(nlinks + 1, sizeof(unsigned char));
+
+	for (k = 0; k < nlinks; k++) {
+		xgraph.out_off[links[k].src + 1]++;
+		xgraph.in_off[links[k].dst + 1]++;
+	}
+	for (i = 0; i < xgraph.nnodes; i++) {
+		xgraph.out_off[i + 1] += xgraph.out_off[i];
+		xgraph.in_off[i + 1] += xgraph.in_off[i];
+	}
+
+	// links are sorted by source: out rows are filled in order
+	for (k = 0; k < nlinks; k++) {
+		xgraph.out_dst[k] = links[k].dst;
+		xgraph.out_kind[k] = links[k].kind;
+	}
+
+	{
+		unsigned int *fill = calloc(xgraph.nnodes + 1, sizeof(unsigned int));
+
+		memcpy(fill, xgraph.in_off, xgraph.nnodes * sizeof(unsigned int));
+		for (k = 0; k < nlinks; k++) {
+			unsigned int at = fill[links[k].dst]++;
+			xgraph.in_src[at] = links[k].src;
+			xgraph.in_kind[at] = links[k].kind;
+		}
+		free(fill);
+	}
+	free(links);
+
+	xgraph.symgen = wsh->symgen;
+	xgraph.seggen = wsh->seggen;
+	xgraph.valid = 1;
+	return 0;
+}
+
+/**
+ * Build the reference graph if missing or out of date
+ */
+static int xref_ready(void)
+{
+	extern wsh_t *wsh;
+
+	if ((xgraph.valid) && (xgraph.symgen == wsh->symgen) && (xgraph.seggen == wsh->seggen)) {
+		return 0;
+	}
+	return xref_build();
+}
+
+/**
+ * Graph node of a lua argument: symbol name, sub_<addr> or address. Returns -1 if unknown.
+ */
+static int xref_node_arg(lua_State *L, int idx)
+{
+	symbols_t *sym = NULL;
+	unsigned long addr = 0;
+	int node = -1;
+
+	if (lua_type(L, idx) == LUA_TNUMBER) {
+		addr = (unsigned long) lua_tonumber(L, idx);
+	} else if ((lua_isstring(L, idx)) && (!strncmp(lua_tostring(L, idx), "sub_", 4))) {
+		addr = strtoul(lua_tostring(L, idx) + 4, NULL, 16);
+	} else if (lua_isstring(L, idx)) {
+		sym = symbol_from_name((char *) lua_tostring(L, idx));
+		if (!sym) {
+			printf("Error: Symbol '%s' not found\n", lua_tostring(L, idx));
+			return -1;
+		}
+		addr = sym->addr;
+	} else {
+		return -1;
+	}
+
+	node = xref_node_at(addr);
+	if (node < 0) {
+		printf("Error: No symbol at 0x%lx\n", addr);
+	}
+	return node;
+}
+
+/**
+ * Build (or rebuild) the cross reference index: xrefs([rebuild])
+ */
+int xrefs(lua_State *L)
+{
+	if (lua_toboolean(L, 1)) {
+		xgraph.valid = 0;
+	}
+
+	if (xref_ready()) {
+		printf("Error: Failed to build cross references\n");
+		return 0;
+	}
+
+	printf(BLUE "\n   Indexed %lu references between %u symbols (%u executable sections, %u objects from cache)\n\n" NORMAL,
+	       (unsigned long) xgraph.nedges, xgraph.nnodes, xgraph.nsections, xgraph.ncached);
+
+	lua_pushinteger(L, xgraph.nedges);
+	return 1;
+}
+
+/**
+ * Shared by callers() and callees(): names of the symbols on one side of the references of a symbol
+ */
+static int xref_neighbours(lua_State *L, int incoming)
+{
+	unsigned int mask = lua_toboolean(L, 2) ? XREF_CODE | XREF_DATA : XREF_CODE;
+	unsigned int *off = NULL, *peer = NULL;
+	unsigned char *kind = NULL;
+	unsigned int k = 0;
+	int node = 0, n = 1;
+
+	if (lua_gettop(L) < 1) {
+		printf("Usage: %s(symbol, [all])\n", incoming ? "callers" : "callees");
+		return 0;
+	}
+
+	if (xref_ready()) {
+		return 0;
+	}
+
+	node = xref_node_arg(L, 1);
+	if (node < 0) {
+		return 0;
+	}
+
+	off = incoming ? xgraph.in_off : xgraph.out_off;
+	peer = incoming ? xgraph.in_src : xgraph.out_dst;
+	kind = incoming ? xgraph.in_kind : xgraph.out_kind;
+
+	lua_newtable(L);
+	for (k = off[node]; k < off[node + 1]; k++) {
+		if (kind[k] & mask) {
+			lua_pushstring(L, xgraph.nodes[peer[k]]->symbol);
+			lua_rawseti(L, -2, n++);
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Symbols referencing a symbol: callers(symbol, [all])
+ */
+int callers(lua_State *L)
+{
+	return xref_neighbours(L, 1);
+}
+
+/**
+ * Symbols referenced by a symbol: callees(symbol, [all])
+ */
+int callees(lua_State *L)
+{
+	return xref_neighbours(L, 0);
+}
+
+/**
+ * Symbols reachable from a symbol through calls and jumps: reachable(symbol, [depth])
+ */
+int reachable(lua_State *L)
+{
+	unsigned char *seen = NULL;
+	unsigned int *queue = NULL;
+	unsigned int head = 0, tail = 0, level_end = 0, depth = 0, maxdepth = 0, k = 0;
+	int node = 0, n = 1;
+
+	if (lua_gettop(L) < 1) {
+		printf("Usage: reachable(symbol, [depth])\n");
+		return 0;
+	}
+
+	if (xref_ready()) {
+		return 0;
+	}
+
+	node = xref_node_arg(L, 1);
+	if (node < 0) {
+		return 0;
+	}
+	maxdepth = lua_isnumber(L, 2) ? (unsigned int) lua_tointeger(L, 2) : 0;	// 0: unlimited
+
+	seen = calloc(xgraph.nnodes, 1);
+	queue = calloc(xgraph.nnodes + 1, sizeof(unsigned int));
+	if ((!seen) || (!queue)) {
+		free(seen);
+		free(queue);
+		return 0;
+	}
+
+	// Breadth first, one level per depth
+	lua_newtable(L);
+	seen[node] = 1;
+	queue[tail++] = node;
+	level_end = tail;
+	while ((head < tail) && ((!maxdepth) || (depth < maxdepth))) {
+		unsigned int cur = queue[head++];
+
+		for (k = xgraph.out_off[cur]; k < xgraph.out_off[cur + 1]; k++) {
+			unsigned int next = xgraph.out_dst[k];
+
+			if ((!(xgraph.out_kind[k] & XREF_CODE)) || (seen[next])) {
+				continue;
+			}
+			seen[next] = 1;
+			queue[tail++] = next;
+			lua_pushstring(L, xgraph.nodes[next]->symbol);
+			lua_rawseti(L, -2, n++);
+		}
+
+		if (head == level_end) {
+			depth++;
+			level_end = tail;
+		}
+	}
+
+	free(seen);
+	free(queue);
+	return 1;
+}
+
 /**
  * Set default architecture
  */
@@ -30,7 +30,9 @@
 */
 
 
+#define _GNU_SOURCE
 #define _XOPEN_SOURCE 500
+#define _DEFAULT_SOURCE
 #define _FILE_OFFSET_BITS 64
 #include <math.h>
 #include <ctype.h>
@@ -45,6 +47,9 @@
 #include <sys/ptrace.h>
 #include <signal.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 
 #include <libwitch/helper.h>
 
@@ -60,21 +65,211 @@ extern int nsections;
 #endif
 
 /*
-* Is a given address mapped ?
+* Cached view of the address space, sorted by address
 */
-int is_mapped(unsigned long int addr){
+struct maprange *mapview = 0;
+unsigned int mapview_num = 0;
+static unsigned int mapview_max = 0;
+static int mapview_fallback = 0;	// /proc/self/maps unavailable : ranges found with mincore()
+
+#define MINCORE_MAX_PAGES 262144	// Largest mincore() batch
+static unsigned char mincore_vec[MINCORE_MAX_PAGES];
+
+/*
+* Insert a range in the view, keeping it sorted
+*/
+static struct maprange *mapview_insert(unsigned long int start, unsigned long int end, const char *perms, const char *name)
+{
+	unsigned int i = 0;
+
+	if (mapview_num == mapview_max) {
+		mapview_max = mapview_max ? mapview_max * 2 : 256;
+		mapview = realloc(mapview, mapview_max * sizeof(struct maprange));
+		if (!mapview) {
+			perror("realloc");
+			mapview_num = mapview_max = 0;
+			return NULL;
+		}
+	}
+
+	for (i = mapview_num; (i > 0) && (mapview[i - 1].start > start); i--) {
+		mapview[i] = mapview[i - 1];
+	}
+
+	memset(&mapview[i], 0x00, sizeof(struct maprange));
+	mapview[i].start = start;
+	mapview[i].end = end;
+	snprintf(mapview[i].perms, sizeof(mapview[i].perms), "%s", perms);
+	snprintf(mapview[i].name, sizeof(mapview[i].name), "%s", name);
+	mapview_num++;
+
+	return &mapview[i];
+}
+
+/*
+* Find the extent of the mapping around addr with mincore() batches of growing size.
+* Only readability is known, from a process_vm_readv() probe of the page of addr.
+*/
+static struct maprange *mapview_probe(unsigned long int addr)
+{
+	unsigned long int ps = sysconf(_SC_PAGESIZE);
+	unsigned long int lo = addr & ~(ps - 1), hi = lo + ps, step = 1;
+	struct iovec local, remote;
+	char byte = 0;
+	int readable = 0;
+
+	if (mincore((void *) lo, ps, mincore_vec)) {
+		return NULL;	// not mapped
+	}
+
+	local.iov_base = &byte;
+	local.iov_len = 1;
+	remote.iov_base = (void *) lo;
+	remote.iov_len = 1;
+	readable = (process_vm_readv(getpid(), &local, 1, &remote, 1, 0) == 1);
+
+	// grow forward
+	while (1) {
+		if ((hi + step * ps > hi) && (!mincore((void *) hi, step * ps, mincore_vec))) {
+			hi += step * ps;
+			step = (step * 2 > MINCORE_MAX_PAGES) ? MINCORE_MAX_PAGES : step * 2;
+		} else if (step > 1) {
+			step /= 2;
+		} else {
+			break;
+		}
+	}
+
+	// grow backward
+	step = 1;
+	while (1) {
+		if ((lo >= step * ps) && (!mincore((void *) (lo - step * ps), step * ps, mincore_vec))) {
+			lo -= step * ps;
+			step = (step * 2 > MINCORE_MAX_PAGES) ? MINCORE_MAX_PAGES : step * 2;
+		} else if (step > 1) {
+			step /= 2;
+		} else {
+			break;
+		}
+	}
+
+	return mapview_insert(lo, hi, readable ? "r---" : "----", "[probed]");
+}
+
+/*
+* Reload the view from a single read of /proc/self/maps
+* (or from mincore() probes around the stack, heap, code and data if unavailable)
+*/
+int mapview_refresh(void)
+{
+	FILE *f = 0;
+	char line[4096];
+	char perms[5], name[255];
+	unsigned long int start = 0, end = 0;
+	int local = 0;
+
+	mapview_num = 0;
+
+	f = fopen("/proc/self/maps", "r");
+	if (!f) {
+		mapview_fallback = 1;
+		mapview_probe((unsigned long int) &local);
+		if (!mapview_find((unsigned long int) sbrk(0) - 1)) {
+			mapview_probe((unsigned long int) sbrk(0) - 1);
+		}
+		if (!mapview_find((unsigned long int) mapview_refresh)) {
+			mapview_probe((unsigned long int) mapview_refresh);
+		}
+		if (!mapview_find((unsigned long int) &mapview)) {
+			mapview_probe((unsigned long int) &mapview);
+		}
+		return 0;
+	}
 
-	struct section *tmpsection = zfirst;
-	while (tmpsection != 0x00) {
-		if ((tmpsection->init <= addr) && (tmpsection->end > addr)) {
-			// return size to end of section
-			return tmpsection->end - addr;
+	mapview_fallback = 0;
+	while (fgets(line, sizeof(line), f)) {
+		memset(name, 0x00, sizeof(name));
+		if (sscanf(line, "%lx-%lx %4s %*x %*x:%*x %*u %254[^\n]", &start, &end, perms, name) < 3) {
+			continue;
 		}
-		tmpsection = tmpsection->next;
+		mapview_insert(start, end, perms, name);
 	}
+	fclose(f);
+
 	return 0;
 }
 
+/*
+* Return index of last range starting at or before addr
+*/
+static int mapview_index(unsigned long int addr)
+{
+	unsigned int lo = 0, hi = mapview_num;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		if (mapview[mid].start <= addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return (int) lo - 1;
+}
+
+/*
+* Find the mapping containing addr in the cached view
+*/
+struct maprange *mapview_find(unsigned long int addr)
+{
+	int i = mapview_index(addr);
+
+	if ((i >= 0) && (mapview[i].end > addr)) {
+		return &mapview[i];
+	}
+	if (mapview_fallback) {
+		return mapview_probe(addr);
+	}
+	return NULL;
+}
+
+/*
+* Is [addr, addr+len) entirely mapped according to the cached view ?
+*/
+int mapview_covers(unsigned long int addr, unsigned long int len)
+{
+	struct maprange *r = 0;
+	unsigned long int end = addr + len;
+
+	while (addr < end) {
+		r = mapview_find(addr);
+		if (!r) {
+			return 0;
+		}
+		addr = r->end;	// continue with the next contiguous range
+	}
+	return 1;
+}
+
+/*
+* Is a given address mapped ? Return size to end of mapping
+*/
+int is_mapped(unsigned long int addr){
+
+	struct maprange *r = 0;
+
+	r = mapview_find(addr);
+	if (!r) {
+		// view may be out of date
+		mapview_refresh();
+		r = mapview_find(addr);
+	}
+	if (!r) {
+		return 0;
+	}
+	return (r->end - addr > INT_MAX) ? INT_MAX : (int) (r->end - addr);
+}
+
 /*
 * read /proc/pid/map
 */
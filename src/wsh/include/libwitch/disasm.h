@@ -48,6 +48,13 @@ typedef struct arch_info {
 	const char *category;
 } arch_info_t;
 
+// Session capstone handle of an architecture, see disasm_handle()
+typedef struct arch_handle {
+	csh handle;
+	int opened;
+	int detail;		// CS_OPT_DETAIL currently enabled on handle
+} arch_handle_t;
+
 // Per-binary architecture tracking
 typedef struct binary_arch {
 	char *filename;
@@ -56,6 +63,168 @@ typedef struct binary_arch {
 	struct binary_arch *next;
 } binary_arch_t;
 
+// Decoded instruction cache
+#define DCACHE_MAX_INSNS	(256 * 1024)
+
+typedef struct dinsn {
+	uint64_t address;
+	uint16_t size;
+	char *mnemonic;
+	char *op_str;
+} dinsn_t;
+
+typedef struct dcache_key {
+	unsigned long addr;
+	unsigned int length;
+	arch_info_t *arch;
+} dcache_key_t;
+
+typedef struct dcache_entry {
+	dcache_key_t key;
+	dinsn_t *insns;
+	size_t count;
+	char *strs;		// mnemonics and operands of insns
+	uint8_t *bytes;		// Code decoded: a hit is only valid if memory still matches
+	struct dcache_entry *prev;	// utlist.h
+	struct dcache_entry *next;	// utlist.h
+	UT_hash_handle hh;	// uthash.h
+} dcache_entry_t;
+
+// Bulk disassembly, see disasm_range()
+#define DR_MAX_THREADS		256
+#define DR_MIN_CHUNK		(64 * 1024)	// Smallest range decoded by one thread
+
+#define DR_FIELD_ADDRESS	1
+#define DR_FIELD_SIZE		2
+#define DR_FIELD_MNEMONIC	4
+#define DR_FIELD_OPERANDS	8
+#define DR_FIELD_ALL		15
+
+typedef struct dr_string {
+	char *str;
+	unsigned int id;
+	UT_hash_handle hh;	// uthash.h
+} dr_string_t;
+
+// Range decoded by one thread, with its own operand string ids
+typedef struct dr_chunk {
+	arch_info_t *arch;
+	unsigned int fields;
+	unsigned long start;
+	unsigned long end;
+	unsigned long limit;	// End of the whole range
+	unsigned long next;	// Address following the last decoded instruction
+	const unsigned long *sync;	// Stop when reaching one of these (sorted) addresses
+	size_t nsync;
+	unsigned long *addr;
+	int *size;
+	int *id;
+	int *op;
+	size_t count;
+	size_t max;
+	dr_string_t *strings;
+	char **strtab;		// Operand strings, by id
+	size_t nstrings;
+	size_t maxstrings;
+	int err;
+} dr_chunk_t;
+
+// Stitched columns returned to lua
+typedef struct dr_result {
+	long *addr;
+	int *size;
+	int *id;
+	int *op;
+	size_t count;
+	size_t max;
+	dr_chunk_t strings;	// Global operand strings
+} dr_result_t;
+
+// Cross references, see xrefs()
+#define XREF_CALL		1
+#define XREF_JUMP		2
+#define XREF_DATA		4	// RIP-relative operand. With XREF_CALL or XREF_JUMP: branch through memory
+#define XREF_CODE		(XREF_CALL | XREF_JUMP)
+
+#define XREF_MAGIC		"WSHXREF"
+#define XREF_VERSION		2
+
+// Direct reference from an instruction, unresolved. On disk: offsets from the object base.
+typedef struct xref_edge {
+	uint64_t src;
+	uint64_t dst;
+	uint32_t kind;
+	uint32_t pad;
+} xref_edge_t;
+
+typedef cache_hdr_t xref_hdr_t;	// Edges only, no tail
+
+// Executable section decoded by one worker
+typedef struct xref_job {
+	unsigned long start;
+	unsigned long end;
+	arch_info_t *arch;
+	struct xref_object *obj;
+	xref_edge_t *edges;
+	size_t count;
+	size_t max;
+	int err;		// Capstone couldn't be initialized
+} xref_job_t;
+
+// Work queue shared by the decoding threads
+typedef struct xref_pool {
+	xref_job_t *jobs;
+	unsigned int njobs;
+	unsigned int next;	// Next job to take
+} xref_pool_t;
+
+// Loaded object, with the edges of all its executable sections
+typedef struct xref_object {
+	char *libname;
+	unsigned long base;
+	char path[PATH_MAX];	// Cache file, empty if none
+	int cached;		// Edges were read from path
+	int partial;		// Some executable sections couldn't be decoded: don't cache
+	xref_edge_t *edges;
+	size_t count;
+	struct xref_object *next;	// utlist.h
+} xref_object_t;
+
+// Final target of a PLT stub or GOT slot, memoized while linking
+typedef struct xref_stub {
+	unsigned long addr;
+	unsigned long target;	// 0 if unresolved
+	UT_hash_handle hh;	// uthash.h
+} xref_stub_t;
+
+// Reference between two symbols (graph node ids)
+typedef struct xref_link {
+	unsigned int src;
+	unsigned int dst;
+	unsigned int kind;
+} xref_link_t;
+
+// Reference graph over symbols, in compressed sparse row form
+typedef struct xref_graph {
+	struct symbols_t **nodes;
+	unsigned int nnodes;
+	struct symbols_t *locals;	// Nodes made up for called functions without a symbol (sub_<addr>)
+	unsigned int nlocals;
+	addrindex_t idx;	// Address -> node id + 1
+	unsigned int *out_off;	// Edges of node n: out_*[out_off[n] .. out_off[n+1])
+	unsigned int *out_dst;
+	unsigned char *out_kind;
+	unsigned int *in_off;
+	unsigned int *in_src;
+	unsigned char *in_kind;
+	size_t nedges;
+	unsigned int nsections;
+	unsigned int ncached;	// Objects read from the cache
+	unsigned long symgen;	// wsh->symgen and wsh->seggen at build time
+	unsigned long seggen;
+	int valid;
+} xref_graph_t;
+
 // Function declarations for wsh integration
 void init_multiarch_support(void);
 void wsh_binary_loaded_hook(const char *filename, unsigned long base_addr);
@@ -64,6 +233,11 @@ void register_disasm_functions(lua_State * L);
 // Lua callable functions
 int disasm(lua_State * L);
 int disasm_sym(lua_State * L);
+int disasm_range(lua_State * L);
+int xrefs(lua_State * L);
+int callers(lua_State * L);
+int callees(lua_State * L);
+int reachable(lua_State * L);
 int arch_set(lua_State * L);
 int arch_info(lua_State * L);
 int arch_list(lua_State * L);
@@ -74,5 +248,7 @@ arch_info_t *get_arch_by_elf_machine(uint16_t machine, uint8_t elf_class, uint8_
 arch_info_t *detect_arch_from_elf(const char *filename);
 void register_binary_arch(const char *filename, unsigned long base_addr);
 arch_info_t *find_arch_for_address(unsigned long addr);
+int disasm_handle(arch_info_t *arch, int detail, csh *handle);
+void disasm_invalidate(unsigned long addr, unsigned long len);
 
 #endif				/* WSH_DISASM_H */
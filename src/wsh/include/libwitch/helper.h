@@ -31,9 +31,14 @@
 
 int read_maps(int pid);
 int is_mapped(unsigned long int addr);
+int mapview_refresh(void);
+struct maprange *mapview_find(unsigned long int addr);
+int mapview_covers(unsigned long int addr, unsigned long int len);
 
 extern struct section *zfirst;
 extern int nsections;
+extern struct maprange *mapview;
+extern unsigned int mapview_num;
 
 /*
 * Data structures
@@ -53,3 +58,10 @@ struct section {
 	int probableval;// aslr stuff (address of most probable mapping)
 };
 
+// mapping of the cached address space view
+struct maprange {
+	unsigned long int start;	// start address
+	unsigned long int end;		// end address
+	char perms[5];			// permissions in human readable form
+	char name[255];			// name
+};
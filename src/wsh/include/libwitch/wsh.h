@@ -55,6 +55,7 @@
 #include <sys/resource.h>
 #include <sys/sendfile.h>
 #include <sys/ptrace.h>
+#include <sys/uio.h>
 
 #ifdef __GLIBC__
 #include <execinfo.h>
@@ -88,6 +89,9 @@
 
 #define MAX_SIGNALS 2000000
 
+#define GREP_CHUNK_SIZE		(1024 * 1024)	// Unit of work of parallel grep
+#define GREP_MAX_THREADS	256
+
 #define MY_CPU 1		// Which CPU to set affinity to
 
 #define BIND_FLAGS             RTLD_NOW
@@ -109,16 +113,38 @@
 #define Elf_Phdr Elf64_Phdr
 #define Elf_Shdr Elf64_Shdr
 #define Elf_Sym  Elf64_Sym
+#define Elf_Nhdr Elf64_Nhdr
 #else
 #define Elf_Dyn  Elf32_Dyn
 #define Elf_Ehdr Elf32_Ehdr
 #define Elf_Phdr Elf32_Phdr
 #define Elf_Shdr Elf32_Shdr
 #define Elf_Sym  Elf32_Sym
+#define Elf_Nhdr Elf32_Nhdr
 #endif
 
 #define HPERMSMAX 5
 
+/**
+* C arrays exposed to lua (lua2c(), disasm_range())
+*/
+#define CARRAY_META "carray_meta"
+
+typedef enum {
+	CARRAY_CHARPTR,
+	CARRAY_INT,
+	CARRAY_LONG,
+	CARRAY_VOIDPTR
+} carray_type_t;
+
+typedef struct {
+	void *data;
+	size_t length;
+	carray_type_t type;
+} carray_t;
+
+int carray_push(lua_State *L, void *data, size_t length, carray_type_t type);
+
 #define ELF32_ST_BIND(val)              (((unsigned char) (val)) >> 4)
 #define ELF32_ST_TYPE(val)              ((val) & 0xf)
 #define ELF32_ST_INFO(bind, type)       (((bind) << 4) + ((type) & 0xf))
@@ -344,14 +370,31 @@ static int alloccharbuf(lua_State * L);
 static int bfmap(lua_State * L);
 static int teletype(lua_State * L);
 static int breakpoint(lua_State * L);
+static int breakpoints(lua_State * L);
+static struct breakpoint_t *bp_install(char *ptr, unsigned int weight, unsigned int flags);
+static void bp_purge(void);
 static int execlib(lua_State * L);
 static int getcharbuf(lua_State * L);
 static int grep(lua_State * L);
 static int grepptr(lua_State * L);
+static int grepmulti(lua_State * L);
+static struct sections_t *maps_to_sections(void);
+static ssize_t read_mem(char *buf, unsigned long int addr, size_t len);
+static void grep_sections(lua_State * L, struct sections_t *list, char *pattern, unsigned int patternlen, unsigned int dumplen, unsigned int nbytesbeforematch);
 static int help(lua_State * L);
 static int hollywood(lua_State * L);
 static int info(lua_State * L);
 static int libcall(lua_State * L);
+static int reflect_call(lua_State * L);
+static int is_lua_identifier(const char *name);
+static int lazy_index(lua_State * L);
+static void reflect_add(char *name, unsigned long int addr);
+static void reflect_drop(unsigned long int start, unsigned long int end);
+static void lazy_globals_install(lua_State * L);
+static int resolve_symbol(char *symbol, char *libname, char **htype, char **hbind, unsigned long int *value, unsigned long int *size, unsigned long int *addr);
+static int is_blacklisted(char *symname);
+static int symcache_buildid(unsigned long int base, char *out, size_t outsz);
+static int symcache_replay(char *path, unsigned long int base, char *libname);
 static int loadbin(lua_State * L);
 static int man(lua_State * L);
 static int map(lua_State * L);
@@ -371,6 +414,11 @@ static int mkptr(lua_State * L);
 static int print_array(lua_State *L);
 int disasm(lua_State * L);
 int disasm_sym(lua_State * L);
+int disasm_range(lua_State * L);
+int xrefs(lua_State * L);
+int callers(lua_State * L);
+int callees(lua_State * L);
+int reachable(lua_State * L);
 int arch_set(lua_State * L);
 int arch_info(lua_State * L);
 int arch_list(lua_State * L);
@@ -383,6 +431,18 @@ static int bsspolute(lua_State * L);
 static unsigned int ltrace(void);
 static int procmap_lua(void);
 static void rescan(void);
+static void full_rescan(void);
+static void rescan_objects(unsigned int full);
+static int lrescan(lua_State * L);
+static int scan_elfs(void);
+static int scan_needed(const char *name, unsigned long int base, unsigned int what);
+static void forget_scanned(unsigned int what);
+static struct scanned_t *scanned_lookup(const char *name, unsigned long int base);
+struct dl_phdr_info;	// <link.h>, only with _GNU_SOURCE
+static int mark_loaded(struct dl_phdr_info *info, size_t size, void *data);
+static void unbind_global(char *name, unsigned long int addr, int object);
+static void drop_range(unsigned long int start, unsigned long int end);
+static void forget_unloaded(void);
 static void hexdump(uint8_t * data, size_t size, size_t colorstart, size_t color_len);
 static int disable_aslr(void);
 static int enable_aslr(void);
@@ -429,22 +489,22 @@ typedef struct {
 
 } elfdata_t;
 
-/**
-* Memory ranges
-*/
-typedef struct range_t {
-	unsigned long long int min;
-	unsigned long long int max;
-} range_t;
-
 
 /**
 * Breakpoint structure
 */
+#define BP_ONESHOT	1	// Coverage: silent, forgotten once hit
+#define BP_HIT		2	// Original byte restored
+
 typedef struct breakpoint_t {
 	char *ptr;		// Pointer to location in memory
 	char backup;		// Backup bytes
 	unsigned int weight;	// Weight (optional)
+	unsigned int id;	// BREAKPOINT[id], in order of creation
+	unsigned int flags;
+
+	UT_hash_handle hh;	// uthash.h, keyed by ptr
+
 } breakpoint_t;
 
 
@@ -517,8 +577,164 @@ typedef struct symbols_t {
 	struct symbols_t *prev;	// utlist.h
 	struct symbols_t *next;	// utlist.h
 
+	UT_hash_handle hh;	// uthash.h, keyed by symbol name
+
 } symbols_t;
 
+/**
+* Objects (name@base) already indexed by rescan(), by kind of scan
+*/
+#define SCANNED_PHDRS	1
+#define SCANNED_SHDRS	2
+#define SCANNED_SYMS	4
+
+typedef struct scanned_t {
+	char *key;
+	unsigned int flags;
+	unsigned long int start;	// Span of the PT_LOAD segments of the object
+	unsigned long int end;
+	unsigned int loaded;	// Still in dl_iterate_phdr(), see forget_unloaded()
+	UT_hash_handle hh;	// uthash.h
+} scanned_t;
+
+/**
+* Interned strings, shared by all symbols (libname, htype, hbind)
+*/
+typedef struct istring_t {
+	char *str;
+	UT_hash_handle hh;	// uthash.h
+} istring_t;
+
+/**
+* Functions whose mangled name differs from their registered (demangled) name,
+* so lazy_index() can resolve reflect_<mangled> like scan_syms() declares it
+*/
+typedef struct reflect_t {
+	char *name;		// Mangled name
+	unsigned long int addr;
+	UT_hash_handle hh;	// uthash.h
+} reflect_t;
+
+/**
+* Sorted, non overlapping address ranges,
+* used to find symbols, sections and segments from an address
+*/
+typedef struct addrrange_t {
+	unsigned long int start;
+	unsigned long int end;	// inclusive
+	void *item;		// symbols_t, sections_t or segments_t
+} addrrange_t;
+
+typedef struct addrindex_t {
+	addrrange_t *ranges;
+	unsigned int nranges;
+	volatile sig_atomic_t valid;	// 0 : out of date, walk the linked list instead
+} addrindex_t;
+
+/**
+* On-disk symbol cache: one file per library in ~/.wsh/cache, keyed by
+* GNU build-id (or device, inode, size and mtime), laid out as
+* header, entries, string table so it can be mmap()ed and replayed.
+*/
+/**
+* Common header of cache files, see cache_map() and cache_write()
+*/
+typedef struct cache_hdr_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t entsize;
+	uint64_t nentries;
+} cache_hdr_t;
+
+#define SYMCACHE_MAGIC		"WSHSYMC"
+#define SYMCACHE_VERSION	1
+#define SYMCACHE_KEYSZ		129
+
+#define SYMCACHE_FUNC		1	// Function (else object)
+#define SYMCACHE_LOCAL		2	// addr is relative to the library base
+#define SYMCACHE_REG		4	// Symbol registry entry resolved
+#define SYMCACHE_REGLOCAL	8	// regaddr is relative to the library base
+
+typedef struct symcache_hdr_t {
+	cache_hdr_t cache;
+	uint64_t strsz;		// String table, after the entries
+} symcache_hdr_t;
+
+typedef struct symcache_ent_t {
+	uint64_t addr;		// Resolved address
+	uint64_t size;		// st_size of the dynamic symbol
+	uint64_t regaddr;	// add_symbol() arguments
+	uint64_t regsize;
+	uint64_t value;
+	uint32_t symname;	// Offsets in the string table
+	uint32_t demangled;
+	uint32_t htype;
+	uint32_t hbind;
+	uint32_t flags;
+	uint32_t pad;
+} symcache_ent_t;
+
+typedef struct symcache_t {	// Cache being built by scan_syms()
+	symcache_ent_t *ents;
+	unsigned long int nents;
+	unsigned long int maxents;
+	char *strs;
+	unsigned long int strsz;
+	unsigned long int strmax;
+} symcache_t;
+
+static uint32_t symcache_addstr(symcache_t *c, const char *str);
+static int symcache_save(char *path, symcache_t *c);
+static int symcache_register(symcache_ent_t *e, char *strs, unsigned long int base, char *regname, char *libname);
+static void bind_symbol(symcache_ent_t *e, char *strs, unsigned long int base, char *libname);
+
+/**
+* Memory search results
+*/
+typedef struct matches_t {
+	unsigned long int *addr;
+	unsigned int num;
+	unsigned int max;
+} matches_t;
+
+/**
+* Parallel memory search (grep{..., threads=N})
+*/
+typedef struct grepchunk_t {
+	sections_t *s;
+	unsigned long int start;	// first address owned by this chunk
+	unsigned long int end;		// end of owned range, matches may extend past it
+	matches_t m;
+} grepchunk_t;
+
+typedef struct grepjob_t {
+	grepchunk_t *chunks;
+	unsigned int nchunks;
+	unsigned int next;		// next chunk to scan (atomic)
+	char *pattern;
+	unsigned long int patternlen;
+	int err;			// errno if memory couldn't be read at all
+} grepjob_t;
+
+/**
+* Aho-Corasick automaton (grepmulti())
+*/
+typedef struct acstate_t {
+	int next[256];		// transitions (complete DFA once built)
+	int fail;		// longest proper suffix state
+	int dict;		// nearest suffix state ending a pattern, 0 if none
+	int pattern;		// first pattern ending in this state, -1 if none
+} acstate_t;
+
+typedef struct acmachine_t {
+	acstate_t *states;
+	unsigned int nstates;
+	unsigned int maxstates;
+	int *samenext;		// next pattern ending in the same state, -1 if none
+	unsigned int *patlen;
+	unsigned int npatterns;
+} acmachine_t;
+
 typedef struct eps_t {
 	unsigned long long int addr;
 	char *name;
@@ -537,6 +753,7 @@ typedef struct wsh_t {
 	lua_State *L;
 	char *luabuff;
 	unsigned int luabuffsz;
+	unsigned int luabufflen;
 
 	char *selflib;
 	char *learnlog;
@@ -553,6 +770,8 @@ typedef struct wsh_t {
 	unsigned int opt_verbosetrace;	// Display verbose trace
 	unsigned int opt_appear;	// Display ourselves or hide ourselves ?
 	unsigned int opt_pagination;
+	unsigned int opt_lazy;	// Resolve symbol globals on demand
+	unsigned int opt_nosymcache;	// Ignore ~/.wsh/cache
 
 	unsigned int opt_userland_load;	// Force use of userland loader
 
@@ -581,7 +800,7 @@ typedef struct wsh_t {
 
 	unsigned int libified;
 
-	breakpoint_t *bp_array;
+	breakpoint_t *bp_hash;	// Breakpoints by address
 	unsigned int bp_num;
 
 	unsigned int opt_argc;
@@ -613,9 +832,20 @@ typedef struct wsh_t {
 
 	struct sections_t *shdrs;
 	struct segments_t *phdrs;
-	struct symbols_t *symbols;
+	struct symbols_t *symbols;	// ordered list
+	struct symbols_t *symhash;	// same symbols, hashed by name
+	struct istring_t *istrings;
+	struct reflect_t *reflects;	// Lazy mode: reflect_<mangled> targets
+	struct scanned_t *scanned;	// objects already indexed
 	struct eps_t *eps;
 
+	// Address lookup indexes, rebuilt by build_addr_indexes()
+	addrindex_t symidx;
+	addrindex_t secidx;
+	addrindex_t segidx;
+	unsigned long int seggen;	// Bumped whenever the segment list changes
+	unsigned long int symgen;	// Bumped whenever the symbol list changes
+
 	struct preload_t *preload;	// Libraries/binaries to preload
 	struct script_t *scripts;	// Queue of scripts to execute
 
@@ -650,6 +880,14 @@ int wsh_init(void);
 int wsh_getopt(int argc, char **argv);
 int wsh_loadlibs(void);
 int reload_elfs(void);
+void build_addr_indexes(void);
+void build_addr_index(addrindex_t *idx, addrrange_t *items, unsigned int n);
+void *addr_index_lookup(addrindex_t *idx, unsigned long int addr);
+int cache_path(void *addr, char *libname, char *ext, char *path, size_t pathsz, unsigned long int *base);
+void *cache_map(char *path, const char *magic, uint32_t version, uint32_t entsize, size_t hdrsz, size_t *mapsz, size_t *tailsz);
+int cache_write(char *path, const char *magic, uint32_t version, uint32_t entsize, void *hdr, size_t hdrsz, const void *ents, uint64_t nents, const void *tail, size_t tailsz);
+symbols_t *symbol_from_name(char *fname);
+sections_t *section_from_addr(unsigned long int addr);
 int wsh_run(void);
 int wsh_usage(char *name);
 int wsh_print_version(void);
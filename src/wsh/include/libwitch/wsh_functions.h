@@ -90,6 +90,7 @@ char *default_options[] = {
 "libcall",
 "loadbin",
 "breakpoint",
+"breakpoints",
 "bp",
 "headers",
 "search",
@@ -105,6 +106,7 @@ char *default_options[] = {
 "testfunc",
 "grep",
 "grepptr",
+"grepmulti",
 "enableaslr",
 "disableaslr",
 "balloc",
@@ -129,6 +131,11 @@ char *default_options[] = {
 "memory2c",
 "disasm",
 "disasm_sym",
+"disasm_range",
+"xrefs",
+"callers",
+"callees",
+"reachable",
 "arch_set",
 "arch_info",
 "arch_list",
@@ -330,9 +337,10 @@ tuple_t exposed[] = {
 {map, "map"},
 {ltrace,"ltrace"},
 {procmap_lua,"procmap"},
-{rescan,"rescan"},
+{lrescan,"rescan"},
 {grep,"grep"},
 {grepptr,"grepptr"},
+{grepmulti,"grepmulti"},
 {hexdump,"lhexdump"},
 {bfmap,"bfmap"},
 {teletype, "teletype"},
@@ -351,6 +359,7 @@ tuple_t exposed[] = {
 {enable_aslr,"enableaslr"},
 {breakpoint,"breakpoint"},
 {breakpoint,"bp"},
+{breakpoints,"breakpoints"},
 {verbose,"verbose"},
 {hollywood,"hollywood"},
 {print_symbols,"symbols"},
@@ -404,6 +413,11 @@ tuple_t exposed[] = {
 {memory2c, "memory2c"},
 {disasm, "disasm"},
 {disasm_sym, "disasm_sym"},
+{disasm_range, "disasm_range"},
+{xrefs, "xrefs"},
+{callers, "callers"},
+{callees, "callees"},
+{reachable, "reachable"},
 {arch_set, "arch_set"},
 {arch_info, "arch_info"},
 {arch_list, "arch_list"},
@@ -411,15 +425,6 @@ tuple_t exposed[] = {
 {ptr2struct, "ptr2struct"}
 };
 
-range_t ranges[] = {
-	{0x00000000, 0x100000000},
-#ifdef __amd64__
-	{0x7f0000000000, 0x800000000000},
-	{0xffffffffff600000, 0xffffffffff610000},
-	{0x000000000000, 0x000000000000}
-#endif
-};
-
 unsigned int global_xalloc = 0;
 
 #endif /* WCC_DEFAULT_FUNCS */
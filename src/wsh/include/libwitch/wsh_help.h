@@ -64,27 +64,34 @@ help_t fcnhelp[] ={
 	{"shdrs", "", "Display ELF section headers from all binaries loaded in address space.", "", "None"},
 	{"map", "", "Display a table of all the memory ranges mapped in memory in the address space.", "", "None"},
 	{"procmap", "", "Display a table of all the memory ranges mapped in memory in the address space as displayed in /proc/<pid>/maps.", "", "None"},
-	{"bfmap", "", "Bruteforce valid mapped memory ranges in address space.", "", "None"},
+	{"bfmap", "", "Display valid mapped memory ranges in address space (from /proc/self/maps, or mincore() probes if unavailable).", "table ranges = ", "Returns 1 lua table of ranges, each a table {start, end, perms, name}."},
 	{"symbols", "[sympattern], [libpattern], [mode]", "Display all the symbols in memory matching [sympattern], from library [libpattern]. If [mode] is set to 1 or 2, do not wait user input between pagers. [mode] = 2 provides a shorter output.", "", "None"},
 	{"functions","[sympattern], [libpattern], [mode]", "Display all the functions in memory matching [sympattern], from library [libpattern]. If [mode] is set to 1 or 2, do not wait user input between pagers. [mode] = 2 provides a shorter output.", "table func = ", "Return 1 lua table _func_ whose keys are valid function names in address space, and values are pointers to them in memory."},
 	{"objects","[pattern]", "Display all the functions in memory matching [sympattern]", "", "None"},
 	{"info", "[address] | [name]", "Display various information about the [address] or [name] provided : if it is mapped, and if so from which library and in which section if available.", "", "None"},
 	{"search", "<pattern>", "Search all object names matching <pattern> in address space.", "", "None"},
 	{"headers", "", "Display C headers suitable for linking against the API loaded in address space.", "", "None"},
-	{"grep", "<pattern>, [patternlen], [dumplen], [before]","Search <pattern> in all ELF sections in memory. Match [patternlen] bytes, then display [dumplen] bytes, optionally including [before] bytes before the match. Results are displayed in enhanced decimal form", "table match = ", "Returns 1 lua table containing matching memory addresses."},
-	{"grepptr", "<pattern>, [patternlen], [dumplen], [before]","Search pointer <pattern> in all ELF sections in memory. Match [patternlen] bytes, then display [dumplen] bytes, optionally including [before] bytes before the match. Results are displayed in enhanced decimal form", "table match = ", "Returns 1 lua table containing matching memory addresses."},
+	{"grep", "<pattern>, [patternlen], [dumplen], [before]","Search <pattern> in all ELF sections in memory. Match [patternlen] bytes. If [dumplen] is given, hexdump [dumplen] bytes of each match, optionally including [before] bytes before the match. grep{pattern, patternlen=, dumplen=, before=, threads=, maps=} scans on [threads] threads (default: one per cpu), over all readable mappings if [maps] is true. Matches are returned in address order.", "table match = ", "Returns 1 lua table containing matching memory addresses."},
+	{"grepptr", "<pattern>, [patternlen], [aligned], [dumplen]","Search pointer <pattern> in all ELF sections in memory. Match [patternlen] bytes (default 8), only at addresses aligned on [patternlen] if [aligned] is set. If [dumplen] is given, hexdump [dumplen] bytes of each match.", "table match = ", "Returns 1 lua table containing matching memory addresses."},
+	{"grepmulti", "<patterns>, [options]","Search all the patterns of table <patterns> in all ELF sections in memory in a single pass (Aho-Corasick). [options] is a table: maps=true scans all readable mappings instead, max=N stops after N hits, quiet=true doesn't display hits.", "table hits = ", "Returns 1 lua table of hits, each a table {pattern_index, address, section}."},
 	{"loadbin","<pathname>","Load binary to memory from <pathname>.", "", "None"},
 	{"libs", "", "Display all libraries loaded in address space.", "table libraries = ", "Returns 1 value: a lua table _libraries_ whose values contain valid binary names (executable/libraries) mapped in memory."},
 	{"entrypoints", "", "Display entry points for each binary loaded in address space.", "", "None"},
-	{"rescan", "", "Re-perform address space scan.", "", "None"},
+	{"rescan", "[full]", "Re-perform address space scan. Only objects loaded since the previous scan are indexed, unless full is true: then all segments, sections and symbols are rebuilt.", "", "None"},
 	{"libcall", "<function>, [arg1], [arg2], ... arg[6]", "Call binary <function> with provided arguments.", "void *ret, table ctx = ", "Returns 2 return values: _ret_ is the return value of the binary function (nill if none), _ctx_ a lua table representing the execution context of the library call.\n"},
 	{"enableaslr", "", "Enable Address Space Layout Randomization (requires root privileges).", "", "None"},
 	{"disableaslr", "", "Disable Address Space Layout Randomization (requires root privileges).", "", "None"},
 	{"verbose", "<verbosity>", "Change verbosity setting to <verbosity>.", "", "None"},
 	{"breakpoint", "<address>, [weight]", "Set a breakpoint at memory <address>. Optionally add a <weight> to breakpoint score if hit.", "", "None"},
 	{"bp", "<address>, [weight]", "Set a breakpoint at memory <address>. Optionally add a <weight> to breakpoint score if hit. Alias for breakpoint() function.", "", "None"},
+	{"breakpoints", "<table of addresses>, [weight]", "Set one-shot breakpoints at all the addresses of a table, making each page writable once. Each breakpoint is silently removed when hit, adding [weight] to the breakpoint score (bp_points). Meant for coverage.", "", "Returns the number of breakpoints set."},
 	{"hollywood", "<level>", "Change hollywood (fun) display setting to <level>, impacting color display (enable/disable).", "", "None"},
 	{"disasm_sym", "<symbol>, [length], [arch]", "Disassemble code at symbol <symbol> for [length] bytes. Uses symbol size if available. Architecture auto-detected from context.", "", "Returns lua table with disassembly results"},
+	{"disasm_range", "<address>, <length>, [{arch=, quiet=, fields=, threads=}]", "Disassemble <length> bytes at <address> in bulk, optionally split across [threads] threads. [fields] selects columns among \"address\", \"size\", \"mnemonic\" and \"operands\" (default: all). Nothing is printed per instruction.", "", "Returns a table of 0-indexed carrays: address, size, mnemonic (capstone instruction id), operands (index in strings), plus strings (unique operand strings), mnemonics (instruction id to name) and count."},
+	{"xrefs", "[rebuild]", "Index direct calls, jumps and RIP-relative references between the symbols of all loaded objects. Each executable section is decoded once, on all cpus; references are cached in ~/.wsh/cache by build-id. Calls through PLT stubs and GOT slots are linked to the function bound in the slot. Called functions without a symbol (static functions) are named sub_<address>, and extend to the next known function. Other queries build the index on demand, and rebuild it after rescan(). Branch targets are only resolved on x86. Calls through function pointers, or through PLT slots not bound yet (lazy binding), are not indexed.", "", "Returns the number of references indexed."},
+	{"callers", "<symbol>, [all]", "List functions calling or jumping to <symbol> (name, sub_<address> or address), directly or through the PLT. If [all] is true, also list functions referencing it through RIP-relative operands.", "", "Returns a lua table of symbol names."},
+	{"callees", "<symbol>, [all]", "List functions called or jumped to by <symbol> (name, sub_<address> or address). If [all] is true, also list symbols it references through RIP-relative operands.", "", "Returns a lua table of symbol names."},
+	{"reachable", "<symbol>, [depth]", "List functions transitively reachable from <symbol> (name, sub_<address> or address) through direct calls and jumps, including through the PLT and static functions, at most [depth] levels deep (default: unlimited).", "", "Returns a lua table of symbol names, closest first."},
 	{"disasm", "<address>, [length], [arch]", "Disassemble code at <address> for [length] bytes using [arch] architecture. Automatic architecture detection from ELF headers. Manual override supported. Supports 20+ architectures including x86, ARM, MIPS, RISC-V, BPF, EVM, etc.", "", "Returns lua table with disassembly results."},
 	{"arch_set", "<architecture>", "Set default architecture for disassembly. Use arch_list() to see supported architectures.", "", "None"},
 	{"arch_info", "", "Display current architecture configuration and loaded binaries.", "", "None"},
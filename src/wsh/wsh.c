@@ -42,7 +42,6 @@
 #include <regex.h>
 #include <link.h>
 
-#define CARRAY_META "carray_meta"
 #define CSTRUCT_META "cstruct_meta"
 #define STRUCT_DEF_META "struct_def_meta"
 
@@ -51,20 +50,6 @@
 * implementing binary reification
 */
 
-typedef enum {
-	CARRAY_CHARPTR,
-	CARRAY_INT,
-	CARRAY_LONG,
-	CARRAY_VOIDPTR
-} carray_type_t;
-
-typedef struct {
-	void *data;
-	size_t length;
-	carray_type_t type;
-} carray_t;
-
-
 // Structure field descriptor
 typedef struct {
 	char name[64];
@@ -101,6 +86,8 @@ void rust_demangle_free(char* ptr);
 */
 int userland_load_binary(char *fname);
 int mk_lib(char *name, unsigned int noinit, unsigned int strip_vernum, unsigned int no_now_flag, unsigned int use_segments);
+void disasm_invalidate(unsigned long addr, unsigned long len);
+void wsh_binary_loaded_hook(const char *filename, unsigned long base_addr);
 
 /**
 * Forward declarations
@@ -319,41 +306,37 @@ char **backtrace_symbols(void *const *buffer, int size) {
 #endif
 
 /**
-* Bruteforce valid memory mapping ranges
+* Display valid memory mapping ranges, return them as a table of {start, end, perms, name}
 */
 int bfmap(lua_State * L)
 {
-	unsigned long int pcounter = 0;
-	unsigned int page_size = 4096;
+	unsigned int i = 0;
 
-	unsigned long long int i = 0, j = 0, r = 0;
+	mapview_refresh();
 
 	printf(GREEN "\n   Memory segments\n\n");
 
-	for (r = 0; r < sizeof(ranges) / sizeof(range_t); r++) {
-		for (i = ranges[r].min; i < ranges[r].max; i += page_size) {
-
-			if (pcounter++ == 10000) {
-				pcounter = 0;
-				printf("  %016llx\r", i);
-			}
-
-			if (msync((void *) i, page_size, MS_ASYNC)) {
-				continue;
-			}	// Invalid page
+	/* create result table */
+	lua_newtable(L);
 
-			// We found a valid page, find length of mapping
-			for (j = 0; j < 0x100000000; j += page_size) {
-				if (msync((void *) i + j, page_size, 0)) {
-					break;
-				}
-			}
-			printf(NORMAL "  %016llx-%016llx\n" GREEN, i, i + j);
-			i += j;
-		}
+	for (i = 0; i < mapview_num; i++) {
+		printf(NORMAL "  %016lx-%016lx %s %s\n" GREEN, mapview[i].start, mapview[i].end, mapview[i].perms, mapview[i].name);
+
+		lua_pushnumber(L, i + 1);
+		lua_newtable(L);
+		lua_pushinteger(L, mapview[i].start);
+		lua_setfield(L, -2, "start");
+		lua_pushinteger(L, mapview[i].end);
+		lua_setfield(L, -2, "end");
+		lua_pushstring(L, mapview[i].perms);
+		lua_setfield(L, -2, "perms");
+		lua_pushstring(L, mapview[i].name);
+		lua_setfield(L, -2, "name");
+		lua_settable(L, -3);
 	}
-	printf(NORMAL "                       \r\n");
-	return 0;
+	printf(NORMAL "\n");
+
+	return 1;
 }
 
 /**
@@ -550,17 +533,17 @@ unsigned int ltrace(void)
 
 
 /**
-* Scan a symbol, save it to linked list
+* Resolve a symbol of a library: type, binding, value, size and address.
+* Returns 1 if the symbol was found.
 */
-int scan_symbol(char *symbol, char *libname)
+static int resolve_symbol(char *symbol, char *libname, char **htype, char **hbind, unsigned long int *value, unsigned long int *size, unsigned long int *addr)
 {
 	struct link_map *handle;
 	Dl_info dli;
 	Elf_Sym *s = 0;
-	char *htype = 0, *hbind = 0;
 	unsigned long int ret = 0;
 	unsigned int stype = 0, sbind = 0;
-	int retv = 0;
+	int found = 0;
 
 	handle = dlopen(libname, wsh->opt_global ? RTLD_NOW | RTLD_GLOBAL : RTLD_NOW);
 	if (!handle) {
@@ -576,26 +559,46 @@ int scan_symbol(char *symbol, char *libname)
 	if ((dladdr1((void*)ret, &dli, (void **) &s, RTLD_DL_SYMENT))&&(s)) {
 
 		stype = ELF_ST_TYPE(s->st_info);
-		htype = symbol_totype(stype);
+		*htype = symbol_totype(stype);
 
 		sbind = ELF_ST_BIND(s->st_info);
-		hbind = symbol_tobind(sbind);
+		*hbind = symbol_tobind(sbind);
 
-		retv = add_symbol(symbol, libname, htype, hbind, s->st_value, s->st_size, ret);
-		if(retv){return retv;}
+		*value = s->st_value;
+		*size = s->st_size;
+		*addr = ret;
+		found = 1;
 #else
 	if (dladdr((void*)ret, &dli)) {
 		stype = 2; // Assume STT_FUNC
-		htype = symbol_totype(stype);
+		*htype = symbol_totype(stype);
 		sbind = 1; // Assume global
-		hbind = symbol_tobind(sbind);
+		*hbind = symbol_tobind(sbind);
 
-		retv = add_symbol(symbol, libname, htype, hbind, (unsigned long)ret - (unsigned long)dli.dli_fbase, 0, ret); // size=0
+		*value = (unsigned long)ret - (unsigned long)dli.dli_fbase;
+		*size = 0;
+		*addr = ret;
+		found = 1;
 #endif
 	}
 
 	dlclose(handle);
-	return 0;
+	return found;
+}
+
+/**
+* Scan a symbol, save it to linked list
+*/
+int scan_symbol(char *symbol, char *libname)
+{
+	char *htype = 0, *hbind = 0;
+	unsigned long int value = 0, size = 0, addr = 0;
+
+	if (!resolve_symbol(symbol, libname, &htype, &hbind, &value, &size, &addr)) {
+		return 0;
+	}
+
+	return add_symbol(symbol, libname, htype, hbind, value, size, addr);
 }
 
 /**
@@ -762,14 +765,15 @@ int help(lua_State * L)
 		printf(" + memory display:\n\t hexdump(), hex_dump(), hex()\n\n");
 		printf(" + memory maps:\n\tshdrs(), phdrs(), map(), procmap(), bfmap()\n\n");
 		printf(" + symbols:\n\tsymbols(), functions(), objects(), info(), search(), headers()\n\n");
-		printf(" + memory search:\n\tgrep(), grepptr()\n\n");
+		printf(" + memory search:\n\tgrep(), grepptr(), grepmulti()\n\n");
 		printf(" + load libraries:\n\tloadbin(), libs(), entrypoints(), rescan()\n\n");
 		printf(" + code execution:\n\tlibcall()\n\n");
 		printf(" + buffer manipulation:\n\txalloc(), ralloc(), xfree(), balloc(), bset(), bget(), rdstr(), rdnum()\n\n");
-		printf(" + control flow:\n\t breakpoint(), bp()\n\n");
+		printf(" + control flow:\n\t breakpoint(), bp(), breakpoints()\n\n");
 		printf(" + system settings:\n\tenableaslr(), disableaslr()\n\n");
 		printf(" + settings:\n\t verbose(), hollywood()\n\n");
-		printf(" + disassembly: disasm(), disasm_sym()\n\n");
+		printf(" + disassembly: disasm(), disasm_sym(), disasm_range()\n\n");
+		printf(" + cross references: xrefs(), callers(), callees(), reachable()\n\n");
 		printf(" + architecture management: arch_set(), arch_info(), arch_list()\n\n");
 		printf(" + structure manipulation: lua2c(), struct2c(), memory2c(), load_struct_def(), ptr2struct()\n\n");
 		printf(" + advanced:\n\tltrace()\n\nTry help(\"cmdname\") for detailed usage on command cmdname.\n\n");
@@ -871,6 +875,7 @@ int phdr_callback(struct dl_phdr_info *info, size_t size, void *data)
 	char *pflags = 0, *ptype = 0;
 	const char *fname = 0;
 	Elf_Phdr *p = 0;
+	scanned_t *o = 0;
 	int j = 0;
 
 	if (wsh->opt_verbose) {
@@ -879,6 +884,10 @@ int phdr_callback(struct dl_phdr_info *info, size_t size, void *data)
 			(void*)info->dlpi_addr, info->dlpi_phnum);
 	}
 
+	if (!scan_needed(info->dlpi_name, info->dlpi_addr, SCANNED_PHDRS)) {
+		return 0;	// Already indexed
+	}
+
 	for (j = 0; j < info->dlpi_phnum; j++) {
 		p = (Elf_Phdr *) &info->dlpi_phdr[j];
 
@@ -901,18 +910,262 @@ int phdr_callback(struct dl_phdr_info *info, size_t size, void *data)
 
 		// Save segment
 		segment_add(info->dlpi_addr + p->p_vaddr, p->p_memsz, pflags, fname, ptype, p->p_flags);
+
+		// Remember where the object lives, to forget it once unloaded
+		o = scanned_lookup(info->dlpi_name, info->dlpi_addr);
+		if ((o) && (p->p_type == PT_LOAD) && (p->p_memsz)) {
+			if ((!o->end) || (info->dlpi_addr + p->p_vaddr < o->start)) {
+				o->start = info->dlpi_addr + p->p_vaddr;
+			}
+			if (info->dlpi_addr + p->p_vaddr + p->p_memsz > o->end) {
+				o->end = info->dlpi_addr + p->p_vaddr + p->p_memsz;
+			}
+		}
+	}
+
+	// Record the architecture of this object, for disassembly
+	if ((fname) && (fname[0] != '[')) {
+		wsh_binary_loaded_hook(fname, info->dlpi_addr);
+	}
+
+	return 0;
+}
+
+/**
+* Return a shared copy of a string
+*/
+static char *intern_string(char *str)
+{
+	istring_t *i = 0;
+
+	HASH_FIND_STR(wsh->istrings, str, i);
+	if(i){ return i->str; }
+
+	i = calloc(1, sizeof(istring_t));
+	if(!i){ fprintf(stderr, "Error: calloc() = %s\n", strerror(errno)); return NULL; }
+	i->str = strdup(str);
+	HASH_ADD_KEYPTR(hh, wsh->istrings, i->str, strlen(i->str), i);
+
+	return i->str;
+}
+
+/**
+* Return 1 if the object loaded at base still needs to be scanned for what
+* (SCANNED_PHDRS, SCANNED_SHDRS or SCANNED_SYMS), and mark it as scanned.
+*/
+static int scan_needed(const char *name, unsigned long int base, unsigned int what)
+{
+	scanned_t *o = 0;
+
+	o = scanned_lookup(name, base);
+	if(!o){
+		return 1;
+	}
+
+	if(o->flags & what){
+		return 0;
+	}
+
+	o->flags |= what;
+	return 1;
+}
+
+/**
+* Find (or create) the scan record of the object loaded at base
+*/
+static scanned_t *scanned_lookup(const char *name, unsigned long int base)
+{
+	scanned_t *o = 0;
+	char key[PATH_MAX + 32];
+
+	snprintf(key, sizeof(key), "%s@%lx", name ? name : "", base);
+
+	HASH_FIND_STR(wsh->scanned, key, o);
+	if(!o){
+		o = calloc(1, sizeof(scanned_t));
+		if(!o){ fprintf(stderr, "Error: calloc() = %s\n", strerror(errno)); return NULL; }
+		o->key = strdup(key);
+		HASH_ADD_KEYPTR(hh, wsh->scanned, o->key, strlen(o->key), o);
+	}
+
+	return o;
+}
+
+/**
+* dl_iterate_phdr() callback : flag objects still loaded
+*/
+static int mark_loaded(struct dl_phdr_info *info, size_t size, void *data)
+{
+	scanned_t *o = 0;
+	char key[PATH_MAX + 32];
+
+	snprintf(key, sizeof(key), "%s@%lx", info->dlpi_name ? info->dlpi_name : "", (unsigned long int) info->dlpi_addr);
+	HASH_FIND_STR(wsh->scanned, key, o);
+	if(o){
+		o->loaded = 1;
 	}
 
 	return 0;
 }
 
+/**
+* Remove a lua global if bind_symbol() or lazy_index() bound it to addr :
+* function, reflect_call() closure, or copy of an object
+*/
+static void unbind_global(char *name, unsigned long int addr, int object)
+{
+	lua_State *L = wsh->L;
+	lua_CFunction f = 0;
+	int bound = 0;
+
+	lua_pushglobaltable(L);
+	lua_pushstring(L, name);
+	lua_rawget(L, -2);	// raw : don't let lazy_index() bind it again
+	f = lua_tocfunction(L, -1);
+	if(f == (lua_CFunction) addr){
+		bound = 1;
+	} else if((f == reflect_call)&&(lua_getupvalue(L, -1, 1))){
+		bound = (lua_tocfunction(L, -1) == (lua_CFunction) addr);
+		lua_pop(L, 1);
+	} else if((object)&&(lua_type(L, -1) == LUA_TSTRING)){
+		bound = 1;
+	}
+	lua_pop(L, 1);
+
+	if(bound){
+		lua_pushstring(L, name);
+		lua_pushnil(L);
+		lua_rawset(L, -3);
+	}
+	lua_pop(L, 1);
+}
+
+/**
+* Drop the segments, sections, symbols and entry points within [start, end),
+* and the lua globals bound from those symbols
+*/
+static void drop_range(unsigned long int start, unsigned long int end)
+{
+	segments_t *seg = 0, *segtmp = 0;
+	sections_t *sec = 0, *sectmp = 0;
+	symbols_t *sym = 0, *symtmp = 0;
+	reflect_t *r = 0, *rtmp = 0;
+	eps_t *ep = 0, *eptmp = 0;
+	char name[1024];
+
+	DL_FOREACH_SAFE(wsh->phdrs, seg, segtmp) {
+		if((seg->addr >= start)&&(seg->addr < end)){
+			wsh->segidx.valid = 0;
+			wsh->seggen++;
+			DL_DELETE(wsh->phdrs, seg);
+			free(seg->type);
+			free(seg->libname);
+			free(seg->perms);
+			free(seg);
+		}
+	}
+
+	DL_FOREACH_SAFE(wsh->shdrs, sec, sectmp) {
+		if((sec->addr >= start)&&(sec->addr < end)){
+			wsh->secidx.valid = 0;
+			DL_DELETE(wsh->shdrs, sec);
+			free(sec->name);
+			free(sec->libname);
+			free(sec->perms);
+			free(sec);
+		}
+	}
+
+	DL_FOREACH_SAFE(wsh->eps, ep, eptmp) {
+		if((ep->addr >= start)&&(ep->addr < end)){
+			DL_DELETE(wsh->eps, ep);
+			free(ep->name);
+			free(ep);
+		}
+	}
+
+	// libname, htype and hbind strings are shared : keep them
+	DL_FOREACH_SAFE(wsh->symbols, sym, symtmp) {
+		if((sym->addr >= start)&&(sym->addr < end)){
+			unbind_global(sym->symbol, sym->addr, (sym->htype)&&(!strcmp(sym->htype, "Object")));
+			snprintf(name, sizeof(name), "reflect_%s", sym->symbol);
+			unbind_global(name, sym->addr, 0);
+
+			wsh->symidx.valid = 0;
+			wsh->symgen++;
+			HASH_DEL(wsh->symhash, sym);
+			DL_DELETE(wsh->symbols, sym);
+			free(sym->symbol);
+			free(sym);
+		}
+	}
+
+	// reflect_<mangled> names of C++ functions
+	HASH_ITER(hh, wsh->reflects, r, rtmp) {
+		if((r->addr >= start)&&(r->addr < end)){
+			snprintf(name, sizeof(name), "reflect_%s", r->name);
+			unbind_global(name, r->addr, 0);
+		}
+	}
+	reflect_drop(start, end);
+}
+
+/**
+* Forget objects no longer loaded, with everything indexed from them
+*/
+static void forget_unloaded(void)
+{
+	scanned_t *o = 0, *otmp = 0;
+
+	HASH_ITER(hh, wsh->scanned, o, otmp) {
+		o->loaded = 0;
+	}
+
+	dl_iterate_phdr(mark_loaded, NULL);
+
+	HASH_ITER(hh, wsh->scanned, o, otmp) {
+		if(o->loaded){
+			continue;
+		}
+		if(wsh->opt_verbose){
+			printf("  * %s unloaded, dropping %lx-%lx\n", o->key, o->start, o->end);
+		}
+		if(o->end){
+			drop_range(o->start, o->end);
+		}
+		HASH_DEL(wsh->scanned, o);
+		free(o->key);
+		free(o);
+	}
+}
+
+/**
+* Forget which objects have been scanned for what, so they get scanned again
+*/
+static void forget_scanned(unsigned int what)
+{
+	scanned_t *o = 0, *otmp = 0;
+
+	HASH_ITER(hh, wsh->scanned, o, otmp) {
+		o->flags &= ~what;
+		if(!o->flags){
+			HASH_DEL(wsh->scanned, o);
+			free(o->key);
+			free(o);
+		}
+	}
+}
+
 /**
 * Add a symbol to linked list
 */
 int add_symbol(char *symbol, char *libname, char *htype, char *hbind, unsigned long value, unsigned int size, unsigned long int addr)
 {
 	symbols_t *s = 0;
-	symbols_t *si = 0, *stmp = 0, *res = 0;
+
+	// search this element by name
+	HASH_FIND_STR(wsh->symhash, symbol, s);
+	if(s){ return 1; } // already in linked list
 
 	s = calloc(1, sizeof(symbols_t));
 	if(!s){ fprintf(stderr, "Error: calloc() = %s\n", strerror(errno)); return -1; }
@@ -920,20 +1173,14 @@ int add_symbol(char *symbol, char *libname, char *htype, char *hbind, unsigned l
 	s->symbol = strdup(symbol);
 	s->size = size;
 	s->value = value;
-	s->libname = strdup(libname);
-	s->htype = strdup(htype);
-	s->hbind = strdup(hbind);
-
-	// search this element in linked list
-	DL_FOREACH_SAFE(wsh->symbols, si, stmp) {
-		// same symbol name
-		if((!strncmp(si->symbol,s->symbol,strlen(si->symbol)))&&(strlen(si->symbol) == strlen(s->symbol))){
-			res = si;
-		}
-	}
-	if(res){ return 1; } // already in linked list
+	s->libname = intern_string(libname);
+	s->htype = intern_string(htype);
+	s->hbind = intern_string(hbind);
 
+	wsh->symidx.valid = 0;
+	wsh->symgen++;
 	DL_APPEND(wsh->symbols, s);
+	HASH_ADD_KEYPTR(hh, wsh->symhash, s->symbol, strlen(s->symbol), s);
 	return 0;
 }
 
@@ -954,6 +1201,7 @@ void section_add(unsigned long int addr, unsigned long int size, char *libname,
 	s->name = strdup(name);
 	s->perms = strdup(perms);
 
+	wsh->secidx.valid = 0;
 	DL_APPEND(wsh->shdrs, s);
 }
 
@@ -973,6 +1221,8 @@ void segment_add(unsigned long int addr, unsigned long int size, char *perms, ch
 	s->perms = strdup(perms);
 	s->type = strdup(ptype);
 
+	wsh->segidx.valid = 0;
+	wsh->seggen++;
 	DL_APPEND(wsh->phdrs, s);
 }
 
@@ -1039,6 +1289,11 @@ int scan_sections(char *fname, unsigned long int baseaddr)
 int shdr_callback(struct dl_phdr_info *info, size_t size, void *data)
 {
 	const char *libname = info->dlpi_name;
+
+	if (!scan_needed(info->dlpi_name, info->dlpi_addr, SCANNED_SHDRS)) {
+		return 0;	// Already indexed
+	}
+
 	if((!libname) || (strlen(libname) < 2)){
 		// On musl, main program might have empty or short name
 		// Use selflib or a default name instead of skipping
@@ -1058,6 +1313,204 @@ int phdrs(lua_State * L)
 	return 0;
 }
 
+/**
+* Compare unsigned longs (qsort helper)
+*/
+static int ulong_cmp(const void *a, const void *b)
+{
+	unsigned long int x = *(const unsigned long int *) a;
+	unsigned long int y = *(const unsigned long int *) b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+* Return index of value in sorted array
+*/
+static unsigned int ulong_bsearch(unsigned long int *a, unsigned int n, unsigned long int value)
+{
+	unsigned int lo = 0, hi = n;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		if (a[mid] < value) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/**
+* Build an address index from n ranges given in list order.
+* Where ranges overlap, the last one in list order wins, like the linear lookups.
+*/
+void build_addr_index(addrindex_t *idx, addrrange_t *items, unsigned int n)
+{
+	unsigned long int *bounds = 0;
+	unsigned int *next = 0;
+	void **owner = 0;
+	addrrange_t *ranges = 0;
+	unsigned int nbounds = 0, nranges = 0, i = 0, j = 0, lo = 0, hi = 0;
+
+	// invalidate first : lookups from signal handlers use the linked lists meanwhile
+	idx->valid = 0;
+	free(idx->ranges);
+	idx->ranges = 0;
+	idx->nranges = 0;
+
+	if (!n) {
+		idx->valid = 1;
+		return;
+	}
+
+	// elementary intervals [bounds[i], bounds[i+1])
+	bounds = calloc(2 * n, sizeof(unsigned long int));
+	next = calloc(2 * n + 1, sizeof(unsigned int));
+	owner = calloc(2 * n, sizeof(void *));
+	ranges = calloc(2 * n, sizeof(addrrange_t));
+	if ((!bounds) || (!next) || (!owner) || (!ranges)) {
+		fprintf(stderr, "Error: calloc() = %s\n", strerror(errno));
+		free(bounds); free(next); free(owner); free(ranges);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		bounds[nbounds++] = items[i].start;
+		bounds[nbounds++] = items[i].end + 1 ? items[i].end + 1 : items[i].end;
+	}
+	qsort(bounds, nbounds, sizeof(unsigned long int), ulong_cmp);
+	for (i = 1, j = 1; i < nbounds; i++) {
+		if (bounds[i] != bounds[j - 1]) {
+			bounds[j++] = bounds[i];
+		}
+	}
+	nbounds = j;
+
+	// paint intervals from the last range to the first, skipping painted ones
+	for (i = 0; i <= nbounds; i++) {
+		next[i] = i;
+	}
+	for (i = n; i-- > 0;) {
+		lo = ulong_bsearch(bounds, nbounds, items[i].start);
+		hi = ulong_bsearch(bounds, nbounds, items[i].end + 1 ? items[i].end + 1 : items[i].end);
+		for (j = lo; j < hi;) {
+			// find first unpainted interval, compressing paths
+			unsigned int r = j, t = 0;
+			while (next[r] != r) {
+				r = next[r];
+			}
+			while (next[j] != r) {
+				t = next[j];
+				next[j] = r;
+				j = t;
+			}
+			j = r;
+			if (j >= hi) {
+				break;
+			}
+			owner[j] = items[i].item;
+			next[j] = j + 1;
+		}
+	}
+
+	// merge adjacent intervals with the same owner
+	for (i = 0; i + 1 < nbounds; i++) {
+		if (!owner[i]) {
+			continue;
+		}
+		if ((nranges) && (ranges[nranges - 1].item == owner[i]) && (ranges[nranges - 1].end + 1 == bounds[i])) {
+			ranges[nranges - 1].end = bounds[i + 1] - 1;
+			continue;
+		}
+		ranges[nranges].start = bounds[i];
+		ranges[nranges].end = bounds[i + 1] - 1;
+		ranges[nranges].item = owner[i];
+		nranges++;
+	}
+
+	free(bounds);
+	free(next);
+	free(owner);
+
+	idx->ranges = ranges;
+	idx->nranges = nranges;
+	idx->valid = 1;
+}
+
+/**
+* Lookup an address index. Doesn't allocate : safe from signal handlers
+*/
+void *addr_index_lookup(addrindex_t *idx, unsigned long int addr)
+{
+	unsigned int lo = 0, hi = idx->nranges;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		if (idx->ranges[mid].start <= addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if ((lo) && (idx->ranges[lo - 1].end >= addr)) {
+		return idx->ranges[lo - 1].item;
+	}
+	return NULL;
+}
+
+/**
+* Rebuild symbols, sections and segments address indexes
+*/
+void build_addr_indexes(void)
+{
+	addrrange_t *items = 0;
+	unsigned int n = 0, cap = 0;
+	symbols_t *sym = 0;
+	sections_t *sec = 0;
+	segments_t *seg = 0;
+
+	DL_COUNT(wsh->symbols, sym, n);
+	cap = n;
+	DL_COUNT(wsh->shdrs, sec, n);
+	cap = n > cap ? n : cap;
+	DL_COUNT(wsh->phdrs, seg, n);
+	cap = n > cap ? n : cap;
+
+	items = calloc(cap + 1, sizeof(addrrange_t));
+	if (!items) {
+		fprintf(stderr, "Error: calloc() = %s\n", strerror(errno));
+		return;
+	}
+
+	n = 0;
+	DL_FOREACH(wsh->symbols, sym) {
+		items[n].start = sym->addr;
+		items[n].end = sym->addr + sym->size;
+		items[n++].item = sym;
+	}
+	build_addr_index(&wsh->symidx, items, n);
+
+	n = 0;
+	DL_FOREACH(wsh->shdrs, sec) {
+		items[n].start = sec->addr;
+		items[n].end = sec->addr + sec->size;
+		items[n++].item = sec;
+	}
+	build_addr_index(&wsh->secidx, items, n);
+
+	n = 0;
+	DL_FOREACH(wsh->phdrs, seg) {
+		items[n].start = seg->addr;
+		items[n].end = seg->addr + seg->size;
+		items[n++].item = seg;
+	}
+	build_addr_index(&wsh->segidx, items, n);
+
+	free(items);
+}
+
 /**
 * Find section from address
 */
@@ -1065,6 +1518,10 @@ sections_t *section_from_addr(unsigned long int addr)
 {
 	sections_t *s = 0, *stmp = 0, *res = 0;
 
+	if (wsh->secidx.valid) {
+		return addr_index_lookup(&wsh->secidx, addr);
+	}
+
 	DL_FOREACH_SAFE(wsh->shdrs, s, stmp) {
 		if((s->addr <= addr)&&(s->addr + s->size >= addr)){
 			res = s;
@@ -1080,6 +1537,10 @@ segments_t *segment_from_addr(unsigned long int addr)
 {
 	segments_t *s = 0, *stmp = 0, *res = 0;
 
+	if (wsh->segidx.valid) {
+		return addr_index_lookup(&wsh->segidx, addr);
+	}
+
 	DL_FOREACH_SAFE(wsh->phdrs, s, stmp) {
 		if((s->addr <= addr)&&(s->addr + s->size >= addr)){
 			res = s;
@@ -1095,6 +1556,10 @@ symbols_t *symbol_from_addr(unsigned long int addr)
 {
 	symbols_t *s = 0, *stmp = 0, *res = 0;
 
+	if (wsh->symidx.valid) {
+		return addr_index_lookup(&wsh->symidx, addr);
+	}
+
 	DL_FOREACH_SAFE(wsh->symbols, s, stmp) {
 		if((s->addr <= addr)&&(s->addr + s->size >= addr)){
 			res = s;
@@ -1110,6 +1575,13 @@ symbols_t *symbol_from_name(char *fname)
 {
 	symbols_t *s = 0, *stmp = 0;
 
+	// exact match
+	HASH_FIND_STR(wsh->symhash, fname, s);
+	if(s){
+		return s;
+	}
+
+	// first symbol starting with fname
 	DL_FOREACH_SAFE(wsh->symbols, s, stmp) {
 		if(!strncmp(fname,s->symbol,strlen(fname))){
 			return s;
@@ -1172,17 +1644,27 @@ int headers(lua_State * L)
 int empty_symbols(void)
 {
 	symbols_t *s = 0, *stmp = 0;
+	istring_t *i = 0, *itmp = 0;
 
+	wsh->symidx.valid = 0;
+	wsh->symgen++;
+	HASH_CLEAR(hh, wsh->symhash);
 	DL_FOREACH_SAFE(wsh->symbols, s, stmp) {
 			DL_DELETE(wsh->symbols, s);
 			free(s->symbol);
-			free(s->hbind);
-			free(s->libname);
-			free(s->htype);
 			free(s);
 
 	}
 
+	reflect_drop(0, (unsigned long int) -1);
+
+	// libname, htype and hbind strings are shared
+	HASH_ITER(hh, wsh->istrings, i, itmp) {
+		HASH_DEL(wsh->istrings, i);
+		free(i->str);
+		free(i);
+	}
+
 	return 0;
 }
 
@@ -1193,6 +1675,8 @@ int empty_phdrs(void)
 {
 	segments_t *s = 0, *stmp = 0;
 
+	wsh->segidx.valid = 0;
+	wsh->seggen++;
 	DL_FOREACH_SAFE(wsh->phdrs, s, stmp) {
 			DL_DELETE(wsh->phdrs, s);
 
@@ -1213,6 +1697,7 @@ int empty_shdrs(void)
 {
 	sections_t *s = 0, *stmp = 0;
 
+	wsh->secidx.valid = 0;
 	DL_FOREACH_SAFE(wsh->shdrs, s, stmp) {
 			DL_DELETE(wsh->shdrs, s);
 
@@ -1965,12 +2450,21 @@ int phdr_cmp(segments_t *a, segments_t *b)
 int reload_elfs(void)
 {
 	empty_eps();
-
 	empty_phdrs();
+	empty_shdrs();
+	forget_scanned(SCANNED_PHDRS | SCANNED_SHDRS);
+
+	return scan_elfs();
+}
+
+/**
+* Add segments, sections and entry points of objects not indexed yet
+*/
+static int scan_elfs(void)
+{
 	dl_iterate_phdr(phdr_callback, NULL);
 	DL_SORT(wsh->phdrs, phdr_cmp);
 
-	empty_shdrs();
 	dl_iterate_phdr(shdr_callback, NULL);
 	DL_SORT(wsh->shdrs, shdr_cmp);
 
@@ -3269,30 +3763,195 @@ static int libcall(lua_State * L)
 }
 
 /**
-* Append a command to internal lua buffer
+* Return 1 if name can be used as a plain lua global name
 */
-int luabuff_append(char *cmd){
+static int is_lua_identifier(const char *name)
+{
+	const char *p = name;
 
-	/**
-	* Allocate wsh->luabuff if it hasn't been initialized
-	*/
-	if(!wsh->luabuff){
-		wsh->luabuff = calloc(1, 4096);
-		wsh->luabuffsz = 4096;
+	if((!name)||(!*name)||(isdigit((unsigned char)*name))){
+		return 0;
 	}
 
+	for(p = name; *p; p++){
+		if((!isalnum((unsigned char)*p))&&(*p != '_')){
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+* Lua wrapper for an exported library function.
+* The function address is stored as upvalue 1: prepend it to the
+* (up to 8) arguments and forward to libcall(), keeping its first 2 results.
+*/
+static int reflect_call(lua_State * L)
+{
+	int n = 0;
+
+	lua_settop(L, 8);
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_insert(L, 1);
+
+	n = libcall(L);
+	if(n > 2){
+		lua_pop(L, n - 2);
+		n = 2;
+	}
+
+	return n;
+}
+
+/**
+* __index metamethod of _G in lazy mode (-l).
+* Resolve an unknown global name through the symbol registry, push the
+* matching function wrapper or object copy, and cache it in _G so later
+* accesses never reach this function again.
+*/
+static int lazy_index(lua_State * L)
+{
+	symbols_t *s = 0;
+	const char *name = 0;
+	unsigned int raw = 0;
+	unsigned int j = 0;
+
+	if(lua_type(L, 2) != LUA_TSTRING){
+		return 0;
+	}
+
+	name = lua_tostring(L, 2);
+	if(!strncmp(name, "reflect_", 8)){	// Raw function pointer, as declared by scan_syms()
+		name += 8;
+		raw = 1;
+	}
+
+	for(j = 0; j < sizeof(lua_blacklist)/sizeof(char*); j++){
+		if(!strcmp(lua_blacklist[j], name)){ return 0; }
+	}
+	for(j = 0; j < sizeof(lua_default_functions)/sizeof(char*); j++){
+		if(!strcmp(lua_default_functions[j], name)){ return 0; }
+	}
+
+	if(raw){
+		reflect_t *r = 0;
+
+		HASH_FIND_STR(wsh->reflects, name, r);
+		if(r){
+			lua_pushcfunction(L, (void *) r->addr);
+			goto bind;
+		}
+	}
+
+	HASH_FIND_STR(wsh->symhash, name, s);
+	if((!s)||(!s->addr)||(!s->htype)){
+		return 0;
+	}
+
+	if(!strcmp(s->htype, "Function")){
+		lua_pushcfunction(L, (void *) s->addr);
+		if(!raw){
+			lua_pushcclosure(L, reflect_call, 1);
+		}
+	} else if((!raw)&&(!strcmp(s->htype, "Object"))&&(msync((void*)(s->addr &~0xfff), 4096, 0) == 0)) {
+		lua_pushlstring(L, (char *) s->addr, s->size);
+	} else {
+		return 0;
+	}
+
+bind:
+	// Cache the binding in _G
+	lua_pushvalue(L, 2);
+	lua_pushvalue(L, -2);
+	lua_rawset(L, 1);
+
+	return 1;
+}
+
+/**
+* Remember the address of a function registered under another (demangled) name :
+* lazy_index() binds reflect_<mangled> from it, drop_range() unbinds it
+*/
+static void reflect_add(char *name, unsigned long int addr)
+{
+	reflect_t *r = 0;
+
+	HASH_FIND_STR(wsh->reflects, name, r);
+	if(!r){
+		r = calloc(1, sizeof(reflect_t));
+		if(!r){ fprintf(stderr, "Error: calloc() = %s\n", strerror(errno)); return; }
+		r->name = strdup(name);
+		HASH_ADD_KEYPTR(hh, wsh->reflects, r->name, strlen(r->name), r);
+	}
+	r->addr = addr;
+}
+
+/**
+* Forget reflect_<mangled> targets within [start, end)
+*/
+static void reflect_drop(unsigned long int start, unsigned long int end)
+{
+	reflect_t *r = 0, *rtmp = 0;
+
+	HASH_ITER(hh, wsh->reflects, r, rtmp) {
+		if((r->addr >= start)&&(r->addr < end)){
+			HASH_DEL(wsh->reflects, r);
+			free(r->name);
+			free(r);
+		}
+	}
+}
+
+/**
+* Resolve globals on demand: set lazy_index() as __index of _G
+*/
+static void lazy_globals_install(lua_State * L)
+{
+	lua_pushglobaltable(L);
+	if(!lua_getmetatable(L, -1)){
+		lua_newtable(L);
+	}
+	lua_pushcfunction(L, lazy_index);
+	lua_setfield(L, -2, "__index");
+	lua_setmetatable(L, -2);
+	lua_pop(L, 1);
+}
+
+/**
+* Append a command to internal lua buffer
+*/
+int luabuff_append(char *cmd){
+
+	size_t len = strlen(cmd);
+	size_t newsz = 0;
+
 	/**
-	* Extend wsh->luabuff by one page if necessary
+	* Allocate wsh->luabuff if it hasn't been initialized
 	*/
-	if(strlen(wsh->luabuff) + strlen(cmd) >= wsh->luabuffsz){
-		wsh->luabuff = realloc(wsh->luabuff, wsh->luabuffsz + 4096);
-		wsh->luabuffsz += 4096;
+	if(!wsh->luabuff){
+		wsh->luabuff = calloc(1, 4096);
+		wsh->luabuffsz = 4096;
+		wsh->luabufflen = 0;
 	}
 
 	/**
-	* Append buffer
+	* Grow wsh->luabuff geometrically so appends stay amortized O(1)
 	*/
-	strcat(wsh->luabuff, cmd);
+	if(wsh->luabufflen + len >= wsh->luabuffsz){
+		newsz = wsh->luabuffsz;
+		while(wsh->luabufflen + len >= newsz){
+			newsz *= 2;
+		}
+		wsh->luabuff = realloc(wsh->luabuff, newsz);
+		wsh->luabuffsz = newsz;
+	}
+
+	/**
+	* Append buffer, tracking its length instead of rescanning it
+	*/
+	memcpy(wsh->luabuff + wsh->luabufflen, cmd, len + 1);
+	wsh->luabufflen += len;
 
 //printf("Appending %s\n", cmd);
 	return 0;
@@ -3412,6 +4071,363 @@ char* universal_demangle(const char* symbol) {
     return demangled ? demangled : strdup(symbol);
 }
 
+/**
+* Return 1 if a symbol name must never be exposed as a lua global
+*/
+static int is_blacklisted(char *symname)
+{
+	unsigned int j = 0;
+
+	for(j = 0; j < sizeof(lua_blacklist)/sizeof(char*); j++){
+		if(!strcmp(lua_blacklist[j], symname)){ return 1; }
+	}
+
+	for(j = 0; j < sizeof(lua_default_functions)/sizeof(char*); j++){
+		if(!strcmp(lua_default_functions[j], symname)){ return 1; }
+	}
+
+	return 0;
+}
+
+/**
+* Read the GNU build-id of the object mapped at base, as an hex string
+*/
+static int symcache_buildid(unsigned long int base, char *out, size_t outsz)
+{
+	Elf_Ehdr *eh = (Elf_Ehdr *) base;
+	Elf_Phdr *ph = 0;
+	Elf_Nhdr *nh = 0;
+	unsigned long int bias = 0, minvaddr = (unsigned long int) -1;
+	unsigned char *p = 0, *end = 0, *desc = 0;
+	unsigned int i = 0, j = 0;
+
+	if((!base)||(memcmp(eh->e_ident, ELFMAG, SELFMAG))){
+		return -1;
+	}
+
+	ph = (Elf_Phdr *) (base + eh->e_phoff);
+	if(msync((void*)((unsigned long int) ph &~0xfff), 4096, 0)){
+		return -1;
+	}
+
+	for(i = 0; i < eh->e_phnum; i++){
+		if((ph[i].p_type == PT_LOAD)&&(ph[i].p_vaddr < minvaddr)){
+			minvaddr = ph[i].p_vaddr;
+		}
+	}
+	if(minvaddr == (unsigned long int) -1){
+		return -1;
+	}
+	bias = base - (minvaddr &~0xfff);
+
+	for(i = 0; i < eh->e_phnum; i++){
+		if(ph[i].p_type != PT_NOTE){
+			continue;
+		}
+
+		p = (unsigned char *) (bias + ph[i].p_vaddr);
+		end = p + ph[i].p_memsz;
+		if(msync((void*)((unsigned long int) p &~0xfff), 4096, 0)){
+			continue;
+		}
+
+		while(p + sizeof(Elf_Nhdr) <= end){
+			nh = (Elf_Nhdr *) p;
+			desc = p + sizeof(Elf_Nhdr) + ((nh->n_namesz + 3) &~3);
+			if(desc + nh->n_descsz > end){
+				break;
+			}
+
+			if((nh->n_type == NT_GNU_BUILD_ID)&&(nh->n_namesz == 4)&&(!memcmp(p + sizeof(Elf_Nhdr), "GNU", 4))&&(nh->n_descsz)&&(nh->n_descsz * 2 < outsz)){
+				for(j = 0; j < nh->n_descsz; j++){
+					snprintf(out + j * 2, 3, "%02x", desc[j]);
+				}
+				return 0;
+			}
+
+			p = desc + ((nh->n_descsz + 3) &~3);
+		}
+	}
+
+	return -1;
+}
+
+/**
+* Compute the path of the cache file (with extension ext) of the library mapped at addr,
+* creating ~/.wsh/cache if needed.
+* Returns 0 on success and fills base with the load address of the library.
+*/
+int cache_path(void *addr, char *libname, char *ext, char *path, size_t pathsz, unsigned long int *base)
+{
+	char key[SYMCACHE_KEYSZ];
+	Dl_info dli;
+	struct stat sb;
+
+	if((!getenv("HOME"))||(!dladdr(addr, &dli))||(!dli.dli_fbase)){
+		return -1;
+	}
+	*base = (unsigned long int) dli.dli_fbase;
+
+	memset(key, 0x00, sizeof(key));
+	if(symcache_buildid(*base, key, sizeof(key))){
+		// No build-id: fall back to file identity
+		if(stat((libname && *libname) ? libname : "/proc/self/exe", &sb)){
+			return -1;
+		}
+		snprintf(key, sizeof(key), "%lx-%lx-%lx-%lx", (unsigned long int) sb.st_dev, (unsigned long int) sb.st_ino,
+			(unsigned long int) sb.st_size, (unsigned long int) sb.st_mtime);
+	}
+
+	snprintf(path, pathsz, "%s/.wsh", getenv("HOME"));
+	if((mkdir(path, 0700))&&(errno != EEXIST)){
+		return -1;
+	}
+	snprintf(path, pathsz, "%s/.wsh/cache", getenv("HOME"));
+	if((mkdir(path, 0700))&&(errno != EEXIST)){
+		return -1;
+	}
+	errno = 0;
+
+	snprintf(path, pathsz, "%s/.wsh/cache/%s-%u.%s", getenv("HOME"), key, (unsigned int) (sizeof(void*) * 8), ext);
+	return 0;
+}
+
+/**
+* Map a cache file written by cache_write(), after checking its header: magic, version,
+* entry size, and room for the entries. hdrsz is the size of the full header.
+* Returns the mapping (mapsz bytes, for munmap()) and fills tailsz with the number of bytes
+* after the entries, or returns NULL if there is no valid cache.
+*/
+void *cache_map(char *path, const char *magic, uint32_t version, uint32_t entsize, size_t hdrsz, size_t *mapsz, size_t *tailsz)
+{
+	cache_hdr_t *hdr = 0;
+	struct stat sb;
+	void *map = 0;
+	int fd = 0;
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0){
+		errno = 0;
+		return NULL;
+	}
+
+	if((fstat(fd, &sb))||((size_t) sb.st_size < hdrsz)){
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED){
+		return NULL;
+	}
+
+	hdr = map;
+	if((memcmp(hdr->magic, magic, sizeof(hdr->magic)))||(hdr->version != version)||(hdr->entsize != entsize)
+		||(hdr->nentries > (uint64_t) (sb.st_size - hdrsz) / entsize)){
+		munmap(map, sb.st_size);
+		return NULL;
+	}
+
+	*mapsz = sb.st_size;
+	*tailsz = sb.st_size - hdrsz - hdr->nentries * entsize;
+	return map;
+}
+
+/**
+* Write a cache file atomically: header (hdrsz bytes, starting with a cache_hdr_t
+* filled from magic, version, entsize and nents), entries, then tailsz bytes of tail.
+*/
+int cache_write(char *path, const char *magic, uint32_t version, uint32_t entsize, void *hdr, size_t hdrsz, const void *ents, uint64_t nents, const void *tail, size_t tailsz)
+{
+	cache_hdr_t *h = hdr;
+	char tmp[PATH_MAX];
+	FILE *f = 0;
+	int ok = 0;
+
+	memcpy(h->magic, magic, sizeof(h->magic));
+	h->version = version;
+	h->entsize = entsize;
+	h->nentries = nents;
+
+	snprintf(tmp, sizeof(tmp), "%s.%u.tmp", path, getpid());
+	f = fopen(tmp, "w");
+	if(!f){
+		return -1;
+	}
+
+	ok = (fwrite(hdr, hdrsz, 1, f) == 1);
+	if((ok)&&(nents)){
+		ok = (fwrite(ents, entsize, nents, f) == nents);
+	}
+	if((ok)&&(tailsz)){
+		ok = (fwrite(tail, 1, tailsz, f) == tailsz);
+	}
+
+	if((fclose(f))||(!ok)||(rename(tmp, path))){
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+* Append a string to the string table of a symbol cache being built
+*/
+static uint32_t symcache_addstr(symcache_t *c, const char *str)
+{
+	size_t len = 0;
+	uint32_t off = 0;
+
+	if((!str)||(!*str)){
+		return 0;	// Offset 0 is the empty string
+	}
+
+	len = strlen(str) + 1;
+	if(c->strsz + len > c->strmax){
+		c->strmax = (c->strmax + len) * 2;
+		c->strs = realloc(c->strs, c->strmax);
+	}
+
+	off = c->strsz;
+	memcpy(c->strs + c->strsz, str, len);
+	c->strsz += len;
+
+	return off;
+}
+
+/**
+* Write a symbol cache to disk (atomically)
+*/
+static int symcache_save(char *path, symcache_t *c)
+{
+	symcache_hdr_t hdr;
+
+	memset(&hdr, 0x00, sizeof(hdr));
+	hdr.strsz = c->strsz;
+
+	return cache_write(path, SYMCACHE_MAGIC, SYMCACHE_VERSION, sizeof(symcache_ent_t), &hdr, sizeof(hdr), c->ents, c->nents, c->strs, c->strsz);
+}
+
+/**
+* Register a (possibly cached) symbol in the symbol registry.
+* Returns the value of add_symbol(), 0 if the symbol could not be resolved.
+*/
+static int symcache_register(symcache_ent_t *e, char *strs, unsigned long int base, char *regname, char *libname)
+{
+	if(!(e->flags & SYMCACHE_REG)){
+		return 0;
+	}
+
+	if(!(e->flags & SYMCACHE_REGLOCAL)){	// Resolved to another object: resolve again
+		return scan_symbol(regname, libname);
+	}
+
+	return add_symbol(regname, libname, e->htype ? strs + e->htype : 0, e->hbind ? strs + e->hbind : 0,
+		e->value, e->regsize, base + e->regaddr);
+}
+
+/**
+* Expose a symbol to lua and register it, from its cache entry
+*/
+static void bind_symbol(symcache_ent_t *e, char *strs, unsigned long int base, char *libname)
+{
+	char newname[1024];
+	char *symname = strs + e->symname;
+	char *demangled = strs + e->demangled;
+	unsigned long int address = 0;
+
+	if(is_blacklisted(symname)){
+#ifdef DEBUG
+		printf(" * blacklisted function name: %s\n", symname);
+#endif
+		return;
+	}
+
+	if(e->flags & SYMCACHE_LOCAL){
+		address = base + e->addr;
+	} else {
+		address = resolve_addr(symname, libname);
+		if((!address)||(address == (unsigned long int) -1)){
+			return;
+		}
+	}
+
+	if((e->flags & SYMCACHE_FUNC)&&(strcmp(symname, demangled))){
+		reflect_add(symname, address);
+	}
+
+	if(wsh->opt_lazy){
+		// Only register the symbol: lazy_index() binds it on first use
+		symcache_register(e, strs, base, (e->flags & SYMCACHE_FUNC) ? demangled : symname, libname);
+	} else if(e->flags & SYMCACHE_FUNC){
+		memset(newname, 0x00, 1024);
+		snprintf(newname, 1023, "reflect_%s", symname);
+		lua_pushcfunction(wsh->L, (void *) address);
+		lua_setglobal(wsh->L, newname);
+
+		if(is_lua_identifier(demangled)){
+			lua_pushcfunction(wsh->L, (void *) address);
+			lua_pushcclosure(wsh->L, reflect_call, 1);
+			lua_setglobal(wsh->L, demangled);
+		}
+		symcache_register(e, strs, base, demangled, libname);
+	} else {
+		if((!symcache_register(e, strs, base, symname, libname))&&(msync((void*)(address &~0xfff), 4096, 0) == 0)) {
+			lua_pushlstring(wsh->L, (char *) address, e->size);
+			lua_setglobal(wsh->L, symname);
+		}
+	}
+}
+
+/**
+* Replay the symbol cache of a library. Returns -1 if there is no valid cache.
+*/
+static int symcache_replay(char *path, unsigned long int base, char *libname)
+{
+	symcache_hdr_t *hdr = 0;
+	symcache_ent_t *ents = 0;
+	char *strs = 0;
+	void *map = 0;
+	size_t mapsz = 0, tailsz = 0;
+	unsigned long int i = 0;
+	int ret = -1;
+
+	map = cache_map(path, SYMCACHE_MAGIC, SYMCACHE_VERSION, sizeof(symcache_ent_t), sizeof(symcache_hdr_t), &mapsz, &tailsz);
+	if(!map){
+		return -1;
+	}
+
+	hdr = map;
+	ents = (symcache_ent_t *) (hdr + 1);
+	strs = (char *) (ents + hdr->cache.nentries);
+
+	// The string table fills the rest of the file
+	if((hdr->strsz == 0)||(hdr->strsz != tailsz)||(strs[hdr->strsz - 1])){
+		goto out;
+	}
+
+	for(i = 0; i < hdr->cache.nentries; i++){
+		if((ents[i].symname >= hdr->strsz)||(ents[i].demangled >= hdr->strsz)||(ents[i].htype >= hdr->strsz)||(ents[i].hbind >= hdr->strsz)){
+			goto out;
+		}
+	}
+
+	if (wsh->opt_verbose) {
+		printf("    * scan_syms: %s, %lu symbols from cache %s\n", libname, (unsigned long int) hdr->cache.nentries, path);
+	}
+
+	for(i = 0; i < hdr->cache.nentries; i++){
+		bind_symbol(&ents[i], strs, base, libname);
+	}
+	ret = 0;
+
+out:
+	munmap(map, mapsz);
+	return ret;
+}
+
 void scan_syms(char *dynstr, Elf_Sym * sym, unsigned long int sz, char *libname, unsigned int nsym)
 {
     unsigned int cnt = 0;
@@ -3419,15 +4435,35 @@ void scan_syms(char *dynstr, Elf_Sym * sym, unsigned long int sz, char *libname,
     unsigned long int address = 0;
     char *demangled = 0, *symname = 0;
     unsigned int func = 0;
-    unsigned int j = 0;
-    unsigned skip_bl = 0;
-    char newname[1024];
-    char *luacmd = 0;
+    unsigned long int i = 0;
+    char path[PATH_MAX];
+    unsigned long int base = 0;
+    unsigned int usecache = 0;
+    symcache_t cache;
+    symcache_ent_t *e = 0;
+    Dl_info dli;
+    char *rtype = 0, *rbind = 0;
+    unsigned long int rvalue = 0, rsize = 0, raddr = 0;
 
     if (wsh->opt_verbose) {
         printf("    * scan_syms: %s, nsym=%u, sz=%lu\n", libname, nsym, sz);
     }
 
+    /**
+    * Replay the on-disk symbol cache of this library if we have one
+    */
+    if ((!wsh->opt_nosymcache) && (sym) && (!cache_path(sym, libname, "sym", path, sizeof(path), &base))) {
+        if (!symcache_replay(path, base, libname)) {
+            return;
+        }
+        usecache = 1;
+    }
+
+    memset(&cache, 0x00, sizeof(cache));
+    cache.strmax = 4096;
+    cache.strs = calloc(1, cache.strmax);
+    cache.strsz = 1;	// Offset 0 is the empty string
+
 #ifdef __GLIBC__
     while ((sym)&&(!msync((long unsigned int)sym &~0xfff,4096,0))) {
 #else
@@ -3481,57 +4517,68 @@ void scan_syms(char *dynstr, Elf_Sym * sym, unsigned long int sz, char *libname,
             address = (unsigned long int) -1;
         }
 
-        demangled = universal_demangle(symname);
-
-        if (strlen(symname) && (htype) && (address != (unsigned long int) -1) && (address)) {
-            skip_bl = 0;
+        if (strlen(symname) && (htype) && (address != (unsigned long int) -1) && (address) && (!is_blacklisted(symname))) {
+            demangled = universal_demangle(symname);
 
-            for(j=0; j < sizeof(lua_blacklist)/sizeof(char*);j++){
-                if((strlen(symname) == strlen(lua_blacklist[j]))&&(!strncmp(lua_blacklist[j] ,symname, strlen(lua_blacklist[j])))){
-                    skip_bl = 1;
-                }
-            }
-
-            for(j=0; j < sizeof(lua_default_functions)/sizeof(char*);j++){
-                if((strlen(symname) == strlen(lua_default_functions[j]))&&(!strncmp(lua_default_functions[j] ,symname, strlen(lua_default_functions[j])))){
-                    skip_bl = 1;
-                }
+            if (cache.nents == cache.maxents) {
+                cache.maxents = cache.maxents ? cache.maxents * 2 : 1024;
+                cache.ents = realloc(cache.ents, cache.maxents * sizeof(symcache_ent_t));
             }
-            
-            if(skip_bl){
-#ifdef DEBUG
-                printf(" * blacklisted function name: %s\n", symname);
-#endif
-            } else if (func) {
-                memset(newname, 0x00, 1024);
-                snprintf(newname, 1023, "reflect_%s", symname);
-                lua_pushcfunction(wsh->L, (void *) address);
-                lua_setglobal(wsh->L, newname);
-
-                luacmd = calloc(1, 1024);
-                snprintf(luacmd,1023, "function %s (a, b, c, d, e, f, g, h) j,k = libcall(%s, a, b, c, d, e, f, g, h); return j, k; end\n", demangled, newname);
-                luabuff_append(luacmd);
-                free(luacmd);
-                scan_symbol(demangled, libname);
+            e = &cache.ents[cache.nents];
+            memset(e, 0x00, sizeof(symcache_ent_t));
+
+            e->symname = symcache_addstr(&cache, symname);
+            e->demangled = symcache_addstr(&cache, demangled);
+            e->size = sym->st_size;
+            e->flags = func ? SYMCACHE_FUNC : 0;
+            // Without a cache file, base is 0 and addresses are stored as is
+            e->flags |= SYMCACHE_LOCAL;
+            e->addr = address;
+            if ((usecache) && ((!dladdr((void *) address, &dli)) || ((unsigned long int) dli.dli_fbase != base))) {
+                e->flags &= ~SYMCACHE_LOCAL;	// Interposed: resolve again on replay
             } else {
-                if((!scan_symbol(symname, libname))&&(msync(address &~0xfff,4096,0) == 0)) {
-                    lua_pushlstring(wsh->L, (char *) address, sym->st_size);
-                    lua_setglobal(wsh->L, symname);
+                e->addr = address - base;
+            }
+
+            // Resolve the registry entry once (scan_symbol() without add_symbol())
+            if (resolve_symbol(func ? demangled : symname, libname, &rtype, &rbind, &rvalue, &rsize, &raddr)) {
+                e->flags |= SYMCACHE_REG | SYMCACHE_REGLOCAL;
+                e->htype = symcache_addstr(&cache, rtype);
+                e->hbind = symcache_addstr(&cache, rbind);
+                e->value = rvalue;
+                e->regsize = rsize;
+                e->regaddr = raddr;
+                if ((usecache) && ((!dladdr((void *) raddr, &dli)) || ((unsigned long int) dli.dli_fbase != base))) {
+                    e->flags &= ~SYMCACHE_REGLOCAL;
+                } else {
+                    e->regaddr = raddr - base;
                 }
             }
+
+            cache.nents++;
+            free(demangled);
         }
 
-        free(demangled);
-        
 #ifdef __GLIBC__
         cnt++;
         sym++;
 #endif
     }
-    
+
     if (wsh->opt_verbose) {
         printf("    * scan_syms complete: processed %u symbols from %s\n", cnt, libname);
     }
+
+    for (i = 0; i < cache.nents; i++) {
+        bind_symbol(&cache.ents[i], cache.strs, base, libname);
+    }
+
+    if ((usecache) && (symcache_save(path, &cache)) && (wsh->opt_verbose)) {
+        printf("    * scan_syms: could not write symbol cache %s\n", path);
+    }
+
+    free(cache.ents);
+    free(cache.strs);
 }
 
 void parse_dyn(struct link_map *map)
@@ -3543,6 +4590,10 @@ void parse_dyn(struct link_map *map)
 	char *dynstr = 0;
 	Elf_Sym *dynsym = 0;
 	unsigned int dynstrsz = 0;
+
+	if (!scan_needed(map->l_name, map->l_addr, SCANNED_SYMS)) {
+		return;		// Already indexed
+	}
 //	char *sec_init = 0;
 //	char *sec_fini = 0;
 //	char *sec_initarray = 0;
@@ -3814,6 +4865,10 @@ static int sym_callback(struct dl_phdr_info *info, size_t size, void *data)
         printf("    * hash: %p, gnu_hash: %p\n", hash, gnu_hash);
     }
     
+    if (!scan_needed(info->dlpi_name, info->dlpi_addr, SCANNED_SYMS)) {
+        return 0;   // Already indexed
+    }
+
     // Validate we have what we need and the values are reasonable
     if (dynstr && dynsym && dynstrsz > 0 && nsym > 0 && nsym < 1000000) {
         if (wsh->opt_verbose) {
@@ -3894,7 +4949,7 @@ int exec_luabuff(void)
 	/**
 	* Load buffer in lua
 	*/
-	if ((err = luaL_loadbuffer(wsh->L, wsh->luabuff, strlen(wsh->luabuff), "=Wsh internal lua buffer")) != 0) {
+	if ((err = luaL_loadbuffer(wsh->L, wsh->luabuff, wsh->luabufflen, "=Wsh internal lua buffer")) != 0) {
 		if (wsh->opt_verbose) {
 			printf("WARNING: Wsh internal lua initialization (%s): %s\n", lua_strerror(err), lua_tostring(wsh->L, -1));
 		}
@@ -3920,6 +4975,7 @@ skipthisone:
 		free(wsh->luabuff);
 		wsh->luabuff = 0;
 		wsh->luabuffsz = 0;
+		wsh->luabufflen = 0;
 
 		return 0;
 	}
@@ -3937,6 +4993,7 @@ skipthisone:
 	free(wsh->luabuff);
 	wsh->luabuff = 0;
 	wsh->luabuffsz = 0;
+	wsh->luabufflen = 0;
 
 	return 0;
 }
@@ -3951,17 +5008,28 @@ void parse_link_vdso(void)
 }
 
 /**
-* Rescan address space
+* Rescan address space.
+* Only objects loaded since the previous scan are processed, unless full is set:
+* then every segment, section and symbol is dropped and indexed again.
 */
-void rescan(void)
+static void rescan_objects(unsigned int full)
 {
     if (wsh->opt_verbose) {
-        printf("  * rescan() called\n");
+        printf("  * rescan(%s) called\n", full ? "full" : "incremental");
     }
-    
-    reload_elfs();
 
-    empty_symbols();
+    if (full) {
+        reload_elfs();
+        empty_symbols();
+        forget_scanned(SCANNED_SYMS);
+    } else {
+        forget_unloaded();
+        scan_elfs();
+    }
+
+    // Objects may have been unmapped, or replaced by new ones
+    disasm_invalidate(0, (unsigned long int) -1);
+
     wsh->opt_rescan = 1;
     
     if (wsh->opt_verbose) {
@@ -3972,12 +5040,38 @@ void rescan(void)
     parse_link_vdso();
     wsh->opt_rescan = 0;
     exec_luabuff();
+    build_addr_indexes();
     
     if (wsh->opt_verbose) {
         printf("  * rescan() complete\n");
     }
 }
 
+/**
+* Index objects loaded since the last scan
+*/
+void rescan(void)
+{
+    rescan_objects(0);
+}
+
+/**
+* Drop and rebuild every index of the address space
+*/
+void full_rescan(void)
+{
+    rescan_objects(1);
+}
+
+/**
+* Lua wrapper: rescan([full])
+*/
+static int lrescan(lua_State * L)
+{
+	rescan_objects(lua_toboolean(L, 1));
+	return 0;
+}
+
 
 /**
 * Display content of /proc/self/maps
@@ -4412,7 +5506,7 @@ int printarg(unsigned long int val)
 
 void traphandler(int signal, siginfo_t * s, void *ptr)
 {
-	unsigned int i = 0;
+	breakpoint_t *bp = 0;
 	char *ptrd = 0x00;
 	ucontext_t *u = 0;
 	unsigned int fault = 0;
@@ -4430,19 +5524,22 @@ void traphandler(int signal, siginfo_t * s, void *ptr)
 	/**
 	* Search corresponding Breakpoint
 	*/
-	for (i = 0; i < wsh->bp_num; i++) {
-		if (wsh->bp_array[i].ptr == (char*)(u->uc_mcontext.gregs[REG_RIP] - 1)) {
-			printf(" ** EXECUTED BREAKPOINT[%u] at %llx	weight:%u	<", i + 1, u->uc_mcontext.gregs[REG_RIP] - 1, wsh->bp_array[i].weight);
+	ptrd = (char*)(u->uc_mcontext.gregs[REG_RIP] - 1);
+	HASH_FIND_PTR(wsh->bp_hash, &ptrd, bp);
+	if ((bp) && (!(bp->flags & BP_HIT))) {
+		if (!(bp->flags & BP_ONESHOT)) {
+			printf(" ** EXECUTED BREAKPOINT[%u] at %llx	weight:%u	<", bp->id, u->uc_mcontext.gregs[REG_RIP] - 1, bp->weight);
 			info_function(u->uc_mcontext.gregs[REG_RIP] - 1);
-			ptrd = u->uc_mcontext.gregs[REG_RIP] - 1;
-			ptrd[0] = wsh->bp_array[i].backup;
-			wsh->bp_points += wsh->bp_array[i].weight;
-
-			// Update bp_points
-			lua_pushnumber(wsh->L, wsh->bp_points);
-			lua_setglobal(wsh->L, "bp_points");
-
 		}
+		ptrd[0] = bp->backup;
+		bp->flags |= BP_HIT;
+		wsh->bp_points += bp->weight;
+
+		// Update bp_points
+		lua_pushnumber(wsh->L, wsh->bp_points);
+		lua_setglobal(wsh->L, "bp_points");
+	} else {
+		ptrd = 0;
 	}
 
 	if (ptrd) {
@@ -4450,7 +5547,9 @@ void traphandler(int signal, siginfo_t * s, void *ptr)
 		* This is a breakpoint
 		*/
 
-		printf(" ** Restoring execution from  %p\n", ptrd);
+		if (!(bp->flags & BP_ONESHOT)) {
+			printf(" ** Restoring execution from  %p\n", ptrd);
+		}
 		u->uc_mcontext.gregs[REG_RIP]--;	// TODO : decrease by full instruction size
 
 	} else if(wsh->trace_singlebranch) {
@@ -4962,7 +6061,7 @@ int wsh_appear(lua_State * L)
 int wsh_hide(lua_State * L)
 {
 	wsh->opt_appear = 0;
-	rescan();
+	full_rescan();	// Objects to hide were already indexed
 
 	return 0;
 }
@@ -5086,22 +6185,130 @@ int bsspolute(lua_State * L)
 /**
 * Search a pattern in memory
 */
-static char *searchmem(char *start, char *pattern, unsigned int patternlen, unsigned int memsz)
+static char *searchmem(char *start, char *pattern, unsigned long int patternlen, unsigned long int memsz)
+{
+	if ((!patternlen) || (patternlen > memsz)) {
+		return 0;
+	}
+
+	// memchr() and memmem() (Two-Way, first byte filtered) are vectorized by the libc
+	if (patternlen == 1) {
+		return memchr(start, pattern[0], memsz);
+	}
+	return memmem(start, memsz, pattern, patternlen);
+}
+
+/**
+* Search a pattern of 1, 2, 4 or 8 bytes at addresses aligned on its size
+*/
+static char *searchmem_aligned(char *start, char *pattern, unsigned long int patternlen, unsigned long int memsz)
+{
+	unsigned long int p = (unsigned long int) start;
+	unsigned long int end = (unsigned long int) start + memsz;
+	uint64_t v64 = 0;
+	uint32_t v32 = 0;
+	uint16_t v16 = 0;
+
+	// round up to first aligned address
+	p = (p + patternlen - 1) & ~(patternlen - 1);
+
+	switch (patternlen) {
+	case 8:
+		memcpy(&v64, pattern, 8);
+		for (; p + 8 <= end; p += 8) {
+			if (*(uint64_t *) p == v64) {
+				return (char *) p;
+			}
+		}
+		return 0;
+	case 4:
+		memcpy(&v32, pattern, 4);
+		for (; p + 4 <= end; p += 4) {
+			if (*(uint32_t *) p == v32) {
+				return (char *) p;
+			}
+		}
+		return 0;
+	case 2:
+		memcpy(&v16, pattern, 2);
+		for (; p + 2 <= end; p += 2) {
+			if (*(uint16_t *) p == v16) {
+				return (char *) p;
+			}
+		}
+		return 0;
+	default:
+		return searchmem(start, pattern, patternlen, memsz);
+	}
+}
+
+/**
+* Search every match of a pattern within a section
+*/
+static void searchmem_all(sections_t *s, char *pattern, unsigned long int patternlen, unsigned int aligned, matches_t *m)
+{
+	char *match = 0;
+	unsigned long int k = 0;
+
+	while (k < s->size) {
+		if (aligned) {
+			match = searchmem_aligned((char *) s->addr + k, pattern, patternlen, s->size - k);
+		} else {
+			match = searchmem((char *) s->addr + k, pattern, patternlen, s->size - k);
+		}
+		if (!match) {
+			break;
+		}
+
+		if (m->num == m->max) {
+			m->max = m->max ? m->max * 2 : 64;
+			m->addr = realloc(m->addr, m->max * sizeof(unsigned long int));
+			if (!m->addr) {
+				fprintf(stderr, "ERROR: realloc() = %s\n", strerror(errno));
+				m->num = m->max = 0;
+				return;
+			}
+		}
+		m->addr[m->num++] = (unsigned long int) match;
+		k = match - (char *) s->addr + 1;
+	}
+}
+
+/**
+* Display the matches of a section and append them to the Lua table on top of the stack
+*/
+static void report_matches(lua_State * L, sections_t *s, matches_t *m, int *count, unsigned long int patternlen, unsigned int dumplen, unsigned int nbytesbeforematch)
 {
 	unsigned int i = 0;
-	char *ptr = 0;
-	unsigned int uplim = 0;
+	char *match = 0;
+
+	for (i = 0; i < m->num; i++) {
+		match = (char *) m->addr[i];
+		*count += 1;
 
-	ptr = start;
-	uplim = memsz - patternlen;
+		if (wsh->opt_hollywood) {
+			printf("    match[" GREEN "%d" NORMAL "] at " GREEN "%p" NORMAL " %lu bytes within:%lx-%lx:" GREEN "%s:%s" NORMAL ":%s\n", *count, match,
+			       match - (char *) s->addr, s->addr, s->addr + s->size, s->libname, s->name, s->perms);
+		} else {
+			printf("    match[%d] at %p %lu bytes within:%lx-%lx:%s:%s\n", *count, match, match - (char *) s->addr, s->addr, s->addr + s->size, s->name, s->perms);
+		}
 
-	for (i = 0; (i < uplim) && (uplim > 0); i++) {
-		if (!memcmp(ptr + i, pattern, patternlen)) {
-			return ptr + i;
+		// hexdump only if asked to
+		if (dumplen) {
+			unsigned long int delta = (s->addr + s->size) - (unsigned long int) match;
+			if (delta > dumplen) {
+				delta = dumplen;
+			};
+			printf("\n");
+			hexdump((unsigned char*)(match - nbytesbeforematch), patternlen + delta, nbytesbeforematch, patternlen);	// Colorize match
+			printf("\n");
 		}
-	}
 
-	return 0;
+		/* Add match to Lua table */
+		lua_pushnumber(L, *count);		/* push key */
+		lua_pushinteger(L, (unsigned long int)match);		/* push value : matching address */
+	        lua_settable(L, -3);
+	}
 }
 
 /**
@@ -5273,179 +6480,718 @@ void systrace(lua_State * L)
 	wsh->trace_rtrace = 0;
 }
 
-void rtrace(lua_State * L)
-{
-	wsh->trace_rtrace = 1;
-	wsh->trace_strace = 0;
+void rtrace(lua_State * L)
+{
+	wsh->trace_rtrace = 1;
+	wsh->trace_strace = 0;
+}
+
+void unsystrace(lua_State * L)
+{
+	wsh->trace_rtrace = 0;
+	wsh->trace_strace = 0;
+}
+
+void unrtrace(lua_State * L)
+{
+	wsh->trace_rtrace = 0;
+	wsh->trace_strace = 0;
+}
+
+
+void verbosetrace(lua_State * L)
+{
+	wsh->opt_verbosetrace = 1;
+}
+
+void unverbosetrace(lua_State * L)
+{
+	wsh->opt_verbosetrace = 0;
+}
+
+void singlebranch(lua_State * L)
+{
+
+	//
+	// Technically, it may be possible to give wsh apabilities to run BTR without uid 0
+	//
+	// sudo setcap cap_sys_rawio=ep ./wsh
+
+	if(getuid() != 0){
+		fprintf(stderr, "ERROR: You need root privileges to use Branch Tracing\n");
+		return;
+	}
+
+	// Load LKMs in kernel land
+	system("sudo modprobe cpuid");
+	system("sudo modprobe msr");
+
+
+	wsh->trace_singlebranch = 1;
+	wsh->trace_singlestep = 0;
+	wsh->trace_unaligned = 0;
+}
+
+void unsinglebranch(lua_State * L)
+{
+	wsh->trace_singlebranch = 0;
+	wsh->trace_singlestep = 0;
+	wsh->trace_unaligned = 0;
+}
+
+/**
+* Search a given value in memory
+*
+* grepptr(Pattern, patternlen, hexadumplen, nbytesbeforematch)
+*
+*/
+int grepptr(lua_State * L)
+{
+	int count = 0;
+	unsigned int dumplen = 0;
+	matches_t m;
+
+	unsigned long int p = 0;
+	char pattern[9];
+	unsigned int patternsz = 0;
+	unsigned int aligned = 0;
+
+	sections_t *s = 0, *stmp = 0;
+
+	read_arg1(p);
+	read_arg2(patternsz);
+	read_arg3(aligned);
+	read_arg(dumplen, 4);
+
+	if (!patternsz) {
+		patternsz = sizeof(unsigned long int);
+	}
+	if (patternsz > 8) {
+		fprintf(stderr, "ERROR: Wrong pattern size:%u > 8\n", patternsz);
+		patternsz = 8;
+	}
+	if ((aligned) && (patternsz & (patternsz - 1))) {
+		aligned = 0;	// only power of 2 sizes can be aligned
+	}
+
+	printf(" -- Searching Pointer: 0x%lx (length:%u aligned:%u)\n", p, patternsz, aligned);
+	memset(pattern, 0x00, 9);
+	memcpy(pattern, &p, patternsz);
+
+	/* create result table */
+	lua_newtable(L);
+
+	mapview_refresh();
+	memset(&m, 0x00, sizeof(matches_t));
+	DL_FOREACH_SAFE(wsh->shdrs, s, stmp) {
+		if (mapview_covers(s->addr, s->size)) {
+			m.num = 0;
+			searchmem_all(s, pattern, patternsz, aligned, &m);
+			report_matches(L, s, &m, &count, patternsz, dumplen, 0);
+		}
+	}
+	free(m.addr);
+
+	// Push number of results as lua return variable
+//	lua_pushinteger(L, count);
+
+	return 1;
+}
+
+/**
+* Allocate a new Aho-Corasick state
+*/
+static int ac_new_state(acmachine_t *ac)
+{
+	acstate_t *states = 0;
+
+	if (ac->nstates == ac->maxstates) {
+		states = realloc(ac->states, (ac->maxstates ? ac->maxstates * 2 : 256) * sizeof(acstate_t));
+		if (!states) {
+			fprintf(stderr, "ERROR: realloc() = %s\n", strerror(errno));
+			return -1;
+		}
+		ac->states = states;
+		ac->maxstates = ac->maxstates ? ac->maxstates * 2 : 256;
+	}
+	memset(&ac->states[ac->nstates], 0x00, sizeof(acstate_t));
+	ac->states[ac->nstates].pattern = -1;
+	return ac->nstates++;
+}
+
+/**
+* Add a pattern to the trie
+*/
+static int ac_add_pattern(acmachine_t *ac, const unsigned char *pattern, unsigned int len, unsigned int index)
+{
+	unsigned int i = 0;
+	int cur = 0, n = 0;
+
+	for (i = 0; i < len; i++) {
+		n = ac->states[cur].next[pattern[i]];
+		if (!n) {	// the root is never a child : 0 means no transition yet
+			n = ac_new_state(ac);
+			if (n < 0) {
+				return -1;
+			}
+			ac->states[cur].next[pattern[i]] = n;
+		}
+		cur = n;
+	}
+
+	// chain patterns ending in this state
+	ac->samenext[index] = ac->states[cur].pattern;
+	ac->states[cur].pattern = index;
+	ac->patlen[index] = len;
+	return 0;
+}
+
+/**
+* Compute failure links and complete the transitions (breadth first)
+*/
+static int ac_build(acmachine_t *ac)
+{
+	int *queue = 0;
+	unsigned int head = 0, tail = 0, c = 0;
+	int u = 0, v = 0, f = 0;
+
+	queue = calloc(ac->nstates, sizeof(int));
+	if (!queue) {
+		fprintf(stderr, "ERROR: calloc() = %s\n", strerror(errno));
+		return -1;
+	}
+
+	for (c = 0; c < 256; c++) {
+		v = ac->states[0].next[c];
+		if (v) {
+			ac->states[v].fail = 0;
+			ac->states[v].dict = 0;
+			queue[tail++] = v;
+		}
+	}
+
+	while (head < tail) {
+		u = queue[head++];
+		for (c = 0; c < 256; c++) {
+			v = ac->states[u].next[c];
+			if (!v) {
+				ac->states[u].next[c] = ac->states[ac->states[u].fail].next[c];
+				continue;
+			}
+			f = ac->states[ac->states[u].fail].next[c];
+			ac->states[v].fail = f;
+			ac->states[v].dict = (ac->states[f].pattern >= 0) ? f : ac->states[f].dict;
+			queue[tail++] = v;
+		}
+	}
+
+	free(queue);
+	return 0;
+}
+
+/**
+* Release an Aho-Corasick automaton
+*/
+static void ac_free(acmachine_t *ac)
+{
+	free(ac->states);
+	free(ac->samenext);
+	free(ac->patlen);
+	memset(ac, 0x00, sizeof(acmachine_t));
+}
+
+/**
+* grepmulti(patterns, [options]) : search many patterns in one pass over memory
+*/
+int grepmulti(lua_State * L)
+{
+	acmachine_t ac;
+	sections_t *list = 0, *s = 0, *stmp = 0;
+	unsigned int i = 0, npatterns = 0, maps = 0, quiet = 0, max = 0, count = 0;
+	unsigned long int k = 0, pos = 0, want = 0;
+	const char *pattern = 0;
+	size_t len = 0;
+	ssize_t n = 0;
+	int state = 0, out = 0, p = 0;
+	unsigned char *buf = 0;
+
+	if (!lua_istable(L, 1)) {
+		fprintf(stderr, "ERROR: grepmulti() needs a table of patterns\n");
+		return 0;
+	}
+
+	if (lua_istable(L, 2)) {
+		lua_getfield(L, 2, "maps");
+		maps = lua_toboolean(L, -1);
+		lua_getfield(L, 2, "quiet");
+		quiet = lua_toboolean(L, -1);
+		lua_getfield(L, 2, "max");
+		max = lua_tointeger(L, -1);
+		lua_pop(L, 3);
+	}
+
+	/**
+	* Compile patterns
+	*/
+	memset(&ac, 0x00, sizeof(acmachine_t));
+	npatterns = lua_rawlen(L, 1);
+	ac.npatterns = npatterns;
+	ac.samenext = calloc(npatterns + 1, sizeof(int));
+	ac.patlen = calloc(npatterns + 1, sizeof(unsigned int));
+	if ((!ac.samenext) || (!ac.patlen) || (ac_new_state(&ac) < 0)) {
+		ac_free(&ac);
+		return 0;
+	}
+
+	for (i = 0; i < npatterns; i++) {
+		lua_rawgeti(L, 1, i + 1);
+		pattern = lua_tolstring(L, -1, &len);
+		if ((pattern) && (len)) {
+			if (ac_add_pattern(&ac, (const unsigned char *) pattern, len, i)) {
+				lua_pop(L, 1);
+				ac_free(&ac);
+				return 0;
+			}
+		} else {
+			ac.samenext[i] = -1;
+			fprintf(stderr, "WARNING: skipping empty pattern %u\n", i + 1);
+		}
+		lua_pop(L, 1);
+	}
+
+	if (ac_build(&ac)) {
+		ac_free(&ac);
+		return 0;
+	}
+
+	buf = malloc(GREP_CHUNK_SIZE);
+	if (!buf) {
+		fprintf(stderr, "ERROR: malloc() = %s\n", strerror(errno));
+		ac_free(&ac);
+		return 0;
+	}
+
+	if (!quiet) {
+		printf(" -- Searching %u patterns (%u states)\n", npatterns, ac.nstates);
+	}
+
+	/* create result table */
+	lua_newtable(L);
+
+	/**
+	* Scan memory in a single pass, through a bounded buffer filled by read_mem() :
+	* special mappings ([vvar], device memory...) can't be read directly
+	*/
+	list = maps ? maps_to_sections() : wsh->shdrs;
+	if (!maps) {
+		mapview_refresh();
+	}
+	DL_FOREACH(list, s) {
+		if ((max) && (count >= max)) {
+			break;
+		}
+		if (!mapview_covers(s->addr, s->size)) {
+			continue;
+		}
+
+		state = 0;
+		pos = s->addr;
+		while (pos < s->addr + s->size) {
+			want = s->addr + s->size - pos;
+			if (want > GREP_CHUNK_SIZE) {
+				want = GREP_CHUNK_SIZE;
+			}
+
+			n = read_mem((char *) buf, pos, want);
+			if ((n < 0) && (maps)) {
+				fprintf(stderr, "ERROR: process_vm_readv() = %s, can't scan mappings\n", strerror(errno));
+				goto done;
+			}
+			if (n < 0) {
+				// process_vm_readv() denied : mapped sections are safe to read directly
+				memcpy(buf, (void *) pos, want);
+				n = want;
+			}
+			if (n == 0) {
+				// unreadable page : skip it, no match spans it
+				state = 0;
+				pos = (pos & ~0xfffUL) + 0x1000;
+				continue;
+			}
+
+			for (k = 0; k < (unsigned long int) n; k++) {
+				state = ac.states[state].next[buf[k]];
+				if (state == 0) {
+					continue;
+				}
+
+				out = (ac.states[state].pattern >= 0) ? state : ac.states[state].dict;
+				for (; out; out = ac.states[out].dict) {
+					for (p = ac.states[out].pattern; p >= 0; p = ac.samenext[p]) {
+						unsigned long int match = pos + k + 1 - ac.patlen[p];
+
+						count++;
+						if (!quiet) {
+							printf("    match[%u] pattern %d at %p %lu bytes within:%lx-%lx:%s:%s\n", count, p + 1, (void *) match,
+							       match - s->addr, s->addr, s->addr + s->size, s->name, s->perms);
+						}
+
+						/* Add {pattern_index, address, section} to Lua table */
+						lua_pushnumber(L, count);
+						lua_newtable(L);
+						lua_pushinteger(L, p + 1);
+						lua_setfield(L, -2, "pattern_index");
+						lua_pushinteger(L, match);
+						lua_setfield(L, -2, "address");
+						lua_pushstring(L, s->name[0] ? s->name : s->libname);
+						lua_setfield(L, -2, "section");
+						lua_settable(L, -3);
+
+						if ((max) && (count >= max)) {
+							goto done;
+						}
+					}
+				}
+			}
+			pos += n;
+		}
+	}
+
+done:
+	if (!quiet) {
+		printf(" -- %u matches\n", count);
+	}
+
+	if (maps) {
+		DL_FOREACH_SAFE(list, s, stmp) {
+			DL_DELETE(list, s);
+			free(s->libname);
+			free(s->name);
+			free(s->perms);
+			free(s);
+		}
+	}
+	free(buf);
+	ac_free(&ac);
+
+	return 1;
+}
+
+/**
+* Load a binary into the address space
+*/
+int loadbin(lua_State * L)
+{
+	char *libname = 0;
+
+	read_arg1(libname);
+	if(!libname){
+		printf("ERROR: missing name of binary to load\n");
+		return 0;
+	}
+
+	do_loadlib(libname);
+	rescan();
+	
+	return 0;
+}
+
+
+/**
+* Readable ranges of the address space as a list of sections
+*/
+static sections_t *maps_to_sections(void)
+{
+	sections_t *list = 0, *s = 0;
+	unsigned int i = 0;
+
+	mapview_refresh();
+
+	for (i = 0; i < mapview_num; i++) {
+		if (mapview[i].perms[0] == '-') {
+			continue;	// not readable
+		}
+		s = calloc(1, sizeof(sections_t));
+		if (!s) {
+			break;
+		}
+		s->addr = mapview[i].start;
+		s->size = mapview[i].end - mapview[i].start;
+		s->libname = strdup(mapview[i].name[0] ? mapview[i].name : "[anonymous]");
+		s->name = strdup("");
+		s->perms = strdup(mapview[i].perms);
+		DL_APPEND(list, s);
+	}
+
+	return list;
 }
 
-void unsystrace(lua_State * L)
+/**
+* Copy memory with process_vm_readv(), which fails instead of faulting.
+* Returns the number of bytes read (0 if the first page isn't readable),
+* or -1 with errno set if process_vm_readv() itself is denied (seccomp, YAMA...).
+*/
+static ssize_t read_mem(char *buf, unsigned long int addr, size_t len)
 {
-	wsh->trace_rtrace = 0;
-	wsh->trace_strace = 0;
+	struct iovec local, remote;
+	ssize_t n = 0;
+
+	local.iov_base = buf;
+	local.iov_len = len;
+	remote.iov_base = (void *) addr;
+	remote.iov_len = len;
+	n = process_vm_readv(getpid(), &local, 1, &remote, 1, 0);
+	if ((n < 0) && (errno == EFAULT)) {
+		errno = 0;
+		return 0;
+	}
+	return n;
 }
 
-void unrtrace(lua_State * L)
+/**
+* Scan one chunk of memory. Memory is copied with read_mem(),
+* so pages unmapped meanwhile are skipped instead of faulting.
+*/
+static void grep_chunk(grepjob_t *job, grepchunk_t *c, char *buf)
 {
-	wsh->trace_rtrace = 0;
-	wsh->trace_strace = 0;
-}
+	unsigned long int pos = c->start;
+	unsigned long int limit = c->s->addr + c->s->size;
+	unsigned long int readend = 0, want = 0, k = 0;
+	ssize_t n = 0;
+	char *match = 0;
 
+	// overlap next chunk by patternlen - 1 bytes so no match is missed
+	readend = c->end + job->patternlen - 1;
+	if (readend > limit) {
+		readend = limit;
+	}
 
-void verbosetrace(lua_State * L)
-{
-	wsh->opt_verbosetrace = 1;
-}
+	while (pos < readend) {
+		want = readend - pos;
+		n = read_mem(buf, pos, want);
+		if (n < 0) {
+			job->err = errno;	// can't read anything : let the caller fall back
+			return;
+		}
+		if (n == 0) {
+			pos = (pos & ~0xfffUL) + 0x1000;	// unmapped page : skip it
+			continue;
+		}
 
-void unverbosetrace(lua_State * L)
-{
-	wsh->opt_verbosetrace = 0;
+		for (k = 0; (match = searchmem(buf + k, job->pattern, job->patternlen, n - k)) != NULL; k = match - buf + 1) {
+			if (pos + (match - buf) >= c->end) {
+				break;	// owned by next chunk
+			}
+			if (c->m.num == c->m.max) {
+				c->m.max = c->m.max ? c->m.max * 2 : 64;
+				c->m.addr = realloc(c->m.addr, c->m.max * sizeof(unsigned long int));
+				if (!c->m.addr) {
+					c->m.num = c->m.max = 0;
+					return;
+				}
+			}
+			c->m.addr[c->m.num++] = pos + (match - buf);
+		}
+
+		pos += n;
+		if ((unsigned long int) n < want) {
+			pos = (pos & ~0xfffUL) + 0x1000;	// skip page which couldn't be read
+		}
+	}
 }
 
-void singlebranch(lua_State * L)
+/**
+* Parallel grep worker : scan chunks until none is left
+*/
+static void *grep_worker(void *arg)
 {
+	grepjob_t *job = (grepjob_t *) arg;
+	unsigned int i = 0;
+	char *buf = 0;
 
-	//
-	// Technically, it may be possible to give wsh apabilities to run BTR without uid 0
-	//
-	// sudo setcap cap_sys_rawio=ep ./wsh
-
-	if(getuid() != 0){
-		fprintf(stderr, "ERROR: You need root privileges to use Branch Tracing\n");
-		return;
+	buf = malloc(GREP_CHUNK_SIZE + job->patternlen);
+	if (!buf) {
+		return NULL;
 	}
 
-	// Load LKMs in kernel land
-	system("sudo modprobe cpuid");
-	system("sudo modprobe msr");
-
+	while (((i = __sync_fetch_and_add(&job->next, 1)) < job->nchunks) && (!job->err)) {
+		grep_chunk(job, &job->chunks[i], buf);
+	}
 
-	wsh->trace_singlebranch = 1;
-	wsh->trace_singlestep = 0;
-	wsh->trace_unaligned = 0;
+	free(buf);
+	return NULL;
 }
 
-void unsinglebranch(lua_State * L)
+/**
+* Compare chunks by address (qsort helper)
+*/
+static int grepchunk_cmp(const void *a, const void *b)
 {
-	wsh->trace_singlebranch = 0;
-	wsh->trace_singlestep = 0;
-	wsh->trace_unaligned = 0;
+	const grepchunk_t *x = (const grepchunk_t *) a;
+	const grepchunk_t *y = (const grepchunk_t *) b;
+
+	return x->start < y->start ? -1 : (x->start > y->start ? 1 : 0);
 }
 
 /**
-* Search a given value in memory
-*
-* grepptr(Pattern, patternlen, hexadumplen, nbytesbeforematch)
-*
+* grep{pattern, [patternlen=], [dumplen=], [before=], [threads=], [maps=]}
+* Scan all sections (or all readable mappings if maps is set) on a pool of threads
 */
-int grepptr(lua_State * L)
+static int grep_threaded(lua_State * L)
 {
-//	char *ptr = 0;
-//	unsigned long int maxlen = 0, i = 0;
-	char *match = 0;
-	int count = 1;
-	unsigned int dumplen = 200;
-	unsigned int k = 0;
+	int count = 0;
+	unsigned int dumplen = 0, nbytesbeforematch = 0, threads = 0, maps = 0;
+	unsigned int i = 0, nchunks = 0, maxchunks = 0;
+	size_t len = 0;
+	sections_t *list = 0, *s = 0, *stmp = 0;
+	pthread_t tids[GREP_MAX_THREADS];
+	grepjob_t job;
+	unsigned long int a = 0;
 
-	unsigned long int p = 0;
-	char pattern[9];
-	unsigned int patternsz = 0;
-	unsigned int aligned = 0;
+	memset(&job, 0x00, sizeof(grepjob_t));
 
-	sections_t *s = 0, *stmp = 0;
+	lua_getfield(L, 1, "pattern");
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		lua_rawgeti(L, 1, 1);
+	}
+	job.pattern = (char *) lua_tolstring(L, -1, &len);
+	lua_pop(L, 1);	// string stays referenced by the argument table
+	if (!job.pattern) {
+		fprintf(stderr, "ERROR: grep{} needs a pattern\n");
+		return 0;
+	}
 
-	read_arg1(p);
-	read_arg2(patternsz);
-	read_arg3(aligned);
+	lua_getfield(L, 1, "patternlen");
+	job.patternlen = lua_tointeger(L, -1);
+	lua_getfield(L, 1, "dumplen");
+	dumplen = lua_tointeger(L, -1);
+	lua_getfield(L, 1, "before");
+	nbytesbeforematch = lua_tointeger(L, -1);
+	lua_getfield(L, 1, "threads");
+	threads = lua_tointeger(L, -1);
+	lua_getfield(L, 1, "maps");
+	maps = lua_toboolean(L, -1);
+	lua_pop(L, 5);
 
-	if (!patternsz) {
-		patternsz = sizeof(unsigned long int);
+	if ((!job.patternlen) || (job.patternlen > len)) {
+		job.patternlen = len;
 	}
-	if (patternsz > 8) {
-		fprintf(stderr, "ERROR: Wrong pattern size:%u > 8\n", patternsz);
+	if (!threads) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (threads > GREP_MAX_THREADS) {
+		threads = GREP_MAX_THREADS;
 	}
-
-	printf(" -- Searching Pointer: 0x%lx (length:%u aligned:%u)\n", p, patternsz, aligned);
-	memset(pattern, 0x00, 9);
-	memcpy(pattern, &p, patternsz);
 
 	/* create result table */
 	lua_newtable(L);
+	if (!job.patternlen) {
+		return 1;
+	}
 
-	DL_FOREACH_SAFE(wsh->shdrs, s, stmp) {
-		k = 0;
-		if (!msync(s->addr&~0xfff, s->size, 0)) {
-		      searchagain:
-			match = searchmem(s->addr + k, pattern, patternsz, s->size - k);
-			if (match) {
-				if (wsh->opt_hollywood) {
-					printf("    match[" GREEN "%d" NORMAL "] at " GREEN "%p" NORMAL " %lu bytes within:%lx-%lx:" GREEN "%s:%s" NORMAL ":%s\n\n", count, match,
-					       match - (char *) s->addr, s->addr, s->addr + s->size, s->libname, s->name, s->perms);
-				} else {
-					printf("    match[%d] at %p %lu bytes within:%lx-%lx:%s:%s\n\n", count, match, match - (char *) s->addr, s->addr, s->addr + s->size, s->name, s->perms);
+	list = maps ? maps_to_sections() : wsh->shdrs;
+
+	// split every range in chunks
+	DL_FOREACH(list, s) {
+		for (a = s->addr; a < s->addr + s->size; a += GREP_CHUNK_SIZE) {
+			if (nchunks == maxchunks) {
+				maxchunks = maxchunks ? maxchunks * 2 : 256;
+				job.chunks = realloc(job.chunks, maxchunks * sizeof(grepchunk_t));
+				if (!job.chunks) {
+					fprintf(stderr, "ERROR: realloc() = %s\n", strerror(errno));
+					return 1;
 				}
-				int delta = (char *) (s->addr+s->size) - match;
-				if (delta > (int)dumplen) {
-					delta = dumplen;
-				};
-				hexdump((unsigned char*)match, patternsz + delta, 0, patternsz);	// Colorize match
-				printf("\n");
+			}
+			memset(&job.chunks[nchunks], 0x00, sizeof(grepchunk_t));
+			job.chunks[nchunks].s = s;
+			job.chunks[nchunks].start = a;
+			job.chunks[nchunks].end = (s->addr + s->size - a > GREP_CHUNK_SIZE) ? a + GREP_CHUNK_SIZE : s->addr + s->size;
+			nchunks++;
+		}
+	}
+	job.nchunks = nchunks;
 
-				/* Add symbol to Lua table */
-				lua_pushnumber(L, count);		/* push key */
-				lua_pushinteger(L, (unsigned long int)match);		/* push value : matching address */
-			        lua_settable(L, -3);
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&tids[i], NULL, grep_worker, &job)) {
+			break;
+		}
+	}
+	threads = i;
+	if (!threads) {
+		grep_worker(&job);	// no thread available : scan from this one
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(tids[i], NULL);
+	}
 
-				count++;
-				k = match - s->addr + 1;
-				goto searchagain;
-			}
+	// merge in address order
+	qsort(job.chunks, nchunks, sizeof(grepchunk_t), grepchunk_cmp);
+	for (i = 0; i < nchunks; i++) {
+		if (!job.err) {
+			report_matches(L, job.chunks[i].s, &job.chunks[i].m, &count, job.patternlen, dumplen, nbytesbeforematch);
 		}
-//		s = s->next;
+		free(job.chunks[i].m.addr);
 	}
+	free(job.chunks);
 
-	// Push number of results as lua return variable
-//	lua_pushinteger(L, count);
+	if ((job.err) && (!maps)) {
+		// sections are safe to read directly : fall back to a serial scan
+		fprintf(stderr, "WARNING: process_vm_readv() = %s, scanning sections serially\n", strerror(job.err));
+		grep_sections(L, wsh->shdrs, job.pattern, job.patternlen, dumplen, nbytesbeforematch);
+	}
+
+	if (maps) {
+		DL_FOREACH_SAFE(list, s, stmp) {
+			DL_DELETE(list, s);
+			free(s->libname);
+			free(s->name);
+			free(s->perms);
+			free(s);
+		}
+	}
+
+	if ((job.err) && (maps)) {
+		return luaL_error(L, "grep{maps=true}: process_vm_readv() = %s", strerror(job.err));
+	}
 
 	return 1;
 }
 
 /**
-* Load a binary into the address space
+* Search a pattern over the mapped sections of a list, adding matches to the table on top of the stack
 */
-int loadbin(lua_State * L)
+static void grep_sections(lua_State * L, sections_t *list, char *pattern, unsigned int patternlen, unsigned int dumplen, unsigned int nbytesbeforematch)
 {
-	char *libname = 0;
+	int count = 0;
+	matches_t m;
+	sections_t *s, *stmp;
 
-	read_arg1(libname);
-	if(!libname){
-		printf("ERROR: missing name of binary to load\n");
-		return 0;
+	mapview_refresh();
+	memset(&m, 0x00, sizeof(matches_t));
+	DL_FOREACH_SAFE(list, s, stmp) {
+		if (mapview_covers(s->addr, s->size)) {
+			m.num = 0;
+			searchmem_all(s, pattern, patternlen, 0, &m);
+			report_matches(L, s, &m, &count, patternlen, dumplen, nbytesbeforematch);
+		}
 	}
-
-	do_loadlib(libname);
-	rescan();
-	
-	return 0;
+	free(m.addr);
 }
 
-
 /**
 * search a pattern over all sections mapped in memory
 */
 int grep(lua_State * L)
 {				// Pattern, patternlen, hexadumplen, nbytesbeforematch
-//	char *ptr = 0;
-//	unsigned int maxlen = 0, i = 0;
-	char *match = 0;
-	int count = 0;
 	char *pattern = 0;
 	unsigned int patternlen = 0;
 	unsigned int dumplen = 0;
 	unsigned int nbytesbeforematch = 0;
-	unsigned int k = 0;
 
-	sections_t *s, *stmp;
+	if (lua_istable(L, 1)) {
+		return grep_threaded(L);
+	}
 
 	read_arg1(pattern);
 	read_arg2(patternlen);
@@ -5456,43 +7202,11 @@ int grep(lua_State * L)
 	if (!patternlen) {
 		patternlen = strlen(pattern);
 	}
-	if (!dumplen) {
-		dumplen = 200;
-	}
 
 	/* create result table */
 	lua_newtable(L);
 
-	DL_FOREACH_SAFE(wsh->shdrs, s, stmp) {
-		k = 0;
-		if (!msync(s->addr&~0xfff, s->size, 0)) {
-		      searchagain:
-			match = searchmem(s->addr + k, pattern, patternlen, s->size - k);
-			if (match) {
-				if (wsh->opt_hollywood) {
-					printf("    match[" GREEN "%d" NORMAL "] at " GREEN "%p" NORMAL " %lu bytes within:%lx-%lx:" GREEN "%s:%s" NORMAL ":%s\n\n", count + 1, match,
-					       match - (char *) s->addr, s->addr, s->addr + s->size, s->libname, s->name, s->perms);
-				} else {
-					printf("    match[%d] at %p %lu bytes within:%lx-%lx:%s:%s\n\n", count + 1, match, match - (char *) s->addr, s->addr, s->addr + s->size, s->name, s->perms);
-				}
-				int delta = (char *) (s->addr+s->size) - match;
-				if (delta > (int)dumplen) {
-					delta = dumplen;
-				};
-				hexdump((unsigned char*)(match - nbytesbeforematch), patternlen + delta, nbytesbeforematch, patternlen);	// Colorize match
-				printf("\n");
-
-				/* Add symbol to Lua table */
-				lua_pushnumber(L, count + 1);		/* push key */
-				lua_pushinteger(L, (unsigned long int)match);		/* push value : matching address */
-			        lua_settable(L, -3);
-
-				count++;
-				k = match - s->addr + 1;
-				goto searchagain;
-			}
-		}
-	}
+	grep_sections(L, wsh->shdrs, pattern, patternlen, dumplen, nbytesbeforematch);
 
 	// Push number of results as lua return variable
 //	lua_pushinteger(L, count);
@@ -5576,6 +7290,61 @@ int priv_strcat(lua_State * L)
 	return 1;
 }
 
+/**
+* Write a breakpoint at ptr (on a writable page) and index it.
+* A breakpoint already hit at this address is armed again.
+* Returns NULL if a breakpoint is already armed there.
+*/
+static breakpoint_t *bp_install(char *ptr, unsigned int weight, unsigned int flags)
+{
+	breakpoint_t *bp = 0;
+
+	HASH_FIND_PTR(wsh->bp_hash, &ptr, bp);
+	if ((bp) && (!(bp->flags & BP_HIT))) {
+		return NULL;
+	}
+
+	if (!bp) {
+		bp = calloc(1, sizeof(breakpoint_t));
+		if (!bp) {
+			fprintf(stderr, "ERROR: calloc() = %s\n", strerror(errno));
+			return NULL;
+		}
+		bp->ptr = ptr;
+		bp->id = ++wsh->bp_num;
+		HASH_ADD_PTR(wsh->bp_hash, ptr, bp);
+	}
+
+	/**
+	* Backup byte at destination
+	*/
+	bp->backup = ptr[0x00];
+	bp->weight = weight;
+	bp->flags = flags;
+
+	/**
+	* Write Breakpoint
+	*/
+	ptr[0x00] = 0xcc;
+
+	return bp;
+}
+
+/**
+* Forget one-shot breakpoints already hit
+*/
+static void bp_purge(void)
+{
+	breakpoint_t *bp = 0, *tmp = 0;
+
+	HASH_ITER(hh, wsh->bp_hash, bp, tmp) {
+		if ((bp->flags & BP_ONESHOT) && (bp->flags & BP_HIT)) {
+			HASH_DEL(wsh->bp_hash, bp);
+			free(bp);
+		}
+	}
+}
+
 /**
 * Set a breakpoint
 */
@@ -5584,53 +7353,107 @@ int breakpoint(lua_State * L)
 	void *arg1 = 0, *arg2 = 0;
 	char *ptr = 0;
 	char *addr = 0;
-	char bk = 0;
+	breakpoint_t *bp = 0;
 
 	read_arg1(arg1);
-	read_arg1(arg2);
+	read_arg2(arg2);
 
 	/**
 	* Make sure destination address is mapped
 	*/
-	if ((!arg1) || (msync((long int)arg1 & (long int)~0xfff, 4096, 0))) {
+	if ((!arg1) || (!is_mapped((unsigned long int) arg1))) {
 		fprintf(stderr, "ERROR: Address %p is not mapped\n", arg1);
 		return 0;
 	}
 
+	ptr = arg1;
+	HASH_FIND_PTR(wsh->bp_hash, &ptr, bp);
+	if ((bp) && (!(bp->flags & BP_HIT))) {
+		fprintf(stderr, "ERROR: BREAKPOINT[%u] already set at %p\n", bp->id, arg1);
+		return 0;
+	}
+
 	/**
 	* Change memory protections to RWX on destionation's page
+	* is_mapped() may answer from a stale view: mprotect() is the live check.
 	*/
-	ptr = arg1;
 	addr = ((unsigned long int) ptr & (unsigned long int) ~0xfff);
-	printf(" ** Setting  BREAKPOINT[%u]  (weigth:%lu)	<", wsh->bp_num + 1, (unsigned long int) arg2);
+	if (mprotect(addr, sysconf(_SC_PAGE_SIZE), PROT_READ | PROT_WRITE | PROT_EXEC)) {
+		fprintf(stderr, "ERROR: Address %p is not mapped\n", arg1);
+		return 0;
+	}
+	printf(" ** Setting  BREAKPOINT[%u]  (weigth:%lu)	<", bp ? bp->id : wsh->bp_num + 1, (unsigned long int) arg2);
 	info_function(arg1);
-	mprotect(addr, sysconf(_SC_PAGE_SIZE), PROT_READ | PROT_WRITE | PROT_EXEC);
 
-	/**
-	* Backup byte at destination
-	*/
-	bk = ptr[0x00];
+	bp_install(ptr, (unsigned long int) arg2, 0);
 
-	/**
-	* Write Breakpoint
-	*/
-	ptr[0x00] = 0xcc;
+	return 0;
+}
 
-	/**
-	* Save breakpoint informations
-	*/
-	if (!wsh->bp_num) {
-		wsh->bp_array = calloc(1, sizeof(breakpoint_t));
-	} else {
-		wsh->bp_array = realloc(wsh->bp_array, sizeof(breakpoint_t) * (wsh->bp_num + 1));
+/**
+* Set many one-shot breakpoints at once (coverage): breakpoints(table_of_addresses, [weight])
+* Addresses are sorted so that each page is made writable once.
+* Each breakpoint is removed when hit, silently adding weight to bp_points.
+*/
+int breakpoints(lua_State * L)
+{
+	void *arg2 = 0;
+	unsigned long int *addrs = 0;
+	unsigned long int pagesz = sysconf(_SC_PAGE_SIZE), page = 0;
+	unsigned int n = 0, i = 0, j = 0, set = 0, pages = 0, skipped = 0;
+	int mapped = 0;
+
+	if (!lua_istable(L, 1)) {
+		printf("Usage: breakpoints(table_of_addresses, [weight])\n");
+		return 0;
 	}
+	read_arg2(arg2);
 
-	wsh->bp_array[wsh->bp_num].ptr = ptr;
-	wsh->bp_array[wsh->bp_num].backup = bk;
-	wsh->bp_array[wsh->bp_num].weight = arg2;
-	wsh->bp_num++;
+	n = lua_rawlen(L, 1);
+	addrs = calloc(n + 1, sizeof(unsigned long int));
+	if (!addrs) {
+		fprintf(stderr, "ERROR: calloc() = %s\n", strerror(errno));
+		return 0;
+	}
 
-	return 0;
+	for (i = 1; i <= n; i++) {
+		lua_rawgeti(L, 1, i);
+		if (lua_isnumber(L, -1)) {
+			addrs[j++] = (unsigned long int) lua_tonumber(L, -1);
+		}
+		lua_pop(L, 1);
+	}
+	skipped = n - j;
+	n = j;
+
+	qsort(addrs, n, sizeof(unsigned long int), ulong_cmp);
+	bp_purge();
+
+	for (i = 0; i < n; i++) {
+		if ((!addrs[i]) || ((i) && (addrs[i] == addrs[i - 1]))) {
+			skipped++;
+			continue;
+		}
+
+		// One check and one mprotect() per page
+		if ((!pages) || ((addrs[i] & ~(pagesz - 1)) != page)) {
+			page = addrs[i] & ~(pagesz - 1);
+			mapped = is_mapped(addrs[i]) && (!mprotect((void *) page, pagesz, PROT_READ | PROT_WRITE | PROT_EXEC));
+			pages++;
+		}
+
+		if ((!mapped) || (!bp_install((char *) addrs[i], (unsigned long int) arg2, BP_ONESHOT))) {
+			skipped++;
+			continue;
+		}
+		set++;
+	}
+	free(addrs);
+
+	printf(" ** Set %u one-shot breakpoints on %u pages (weight:%lu), %u skipped\n", set, pages, (unsigned long int) arg2, skipped);
+
+	lua_pushinteger(L, set);
+	return 1;
 }
 
 void declare_func(void *addr, char *name)
@@ -6008,6 +7831,7 @@ int wsh_run(void)
 	* run internal lua buffers
 	*/
 	exec_luabuff();
+	build_addr_indexes();
 
 	if (wsh->opt_verbose) {
 		printf(" -- Running startup lua scripts\n");
@@ -6291,7 +8115,7 @@ int wsh_loadlibs(void)
 */
 int wsh_getopt(int argc, char **argv)
 {
-	const char *short_opt = "hqvVxgup";
+	const char *short_opt = "hqvVxguplN";
 	int count = 0;
 	struct stat sb;
 	int c = 0, i = 0;
@@ -6305,6 +8129,8 @@ int wsh_getopt(int argc, char **argv)
 		{"version", no_argument, NULL, 'V'},
 		{"userland", no_argument, NULL, 'u'},
 		{"pagination", no_argument, NULL, 'p'},
+		{"lazy", no_argument, NULL, 'l'},
+		{"no-symcache", no_argument, NULL, 'N'},
 		{NULL, 0, NULL, 0}
 	};
 
@@ -6332,6 +8158,14 @@ int wsh_getopt(int argc, char **argv)
 			wsh->opt_pagination = 1;
 			break;
 
+		case 'l':
+			wsh->opt_lazy = 1;
+			break;
+
+		case 'N':
+			wsh->opt_nosymcache = 1;
+			break;
+
 		case 'q':
 			wsh->opt_quiet = 1;
 			break;
@@ -6362,6 +8196,10 @@ int wsh_getopt(int argc, char **argv)
 
 nomoreargs:
 
+	if (wsh->opt_lazy) {
+		lazy_globals_install(wsh->L);
+	}
+
 	if (count >= argc - 1) {
 		return 0;	// no file argument
 	}
@@ -6427,6 +8265,8 @@ int wsh_usage(char *name)
 	printf("    -p, --pagination          Use pagination in outputs\n");
 	printf("    -v, --verbose             Display more output\n");
 	printf("    -g, --global              Bind symbols globally\n");
+	printf("    -l, --lazy                Resolve symbols as lua globals on first use\n");
+	printf("    -N, --no-symcache         Do not use the symbol cache in ~/.wsh/cache\n");
 	printf("    -u, --userland-load       Force use userland loader\n");	
 	printf("    -V, --version             Display version and build, then exit\n");
 	printf("\n");
@@ -6888,6 +8728,23 @@ static int carray_len(lua_State *L)
 	return 1;
 }
 
+/**
+* Push a carray wrapping data (allocated with malloc), which is freed by the lua GC
+*/
+int carray_push(lua_State *L, void *data, size_t length, carray_type_t type)
+{
+	carray_t *carr = (carray_t *) lua_newuserdata(L, sizeof(carray_t));
+
+	carr->data = data;
+	carr->length = length;
+	carr->type = type;
+
+	luaL_getmetatable(L, CARRAY_META);
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
 /**
 * Main conversion function: lua2c(table, type)
 */